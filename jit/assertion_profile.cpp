@@ -0,0 +1,58 @@
+#include "assertion_profile.hpp"
+
+#include "smtlib_parser.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace smt_jit {
+
+AssertionProfile::AssertionProfile(size_t numAssertions)
+    : m_failures(numAssertions, 0) {}
+
+void AssertionProfile::record(llvm::ArrayRef<int> results) {
+  for (int res : results) {
+    assert(res >= 0 && static_cast<size_t>(res) <= m_failures.size());
+    if (res != 0)
+      ++m_failures[res - 1];
+  }
+
+  m_numSamples += results.size();
+}
+
+std::vector<unsigned>
+AssertionProfile::computeOrder(llvm::ArrayRef<unsigned> costs) const {
+  assert(costs.size() == m_failures.size());
+
+  std::vector<unsigned> order(m_failures.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  // Compare failures[a] / costs[a] > failures[b] / costs[b] without division.
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    const size_t costA = std::max(costs[a], 1u);
+    const size_t costB = std::max(costs[b], 1u);
+    return m_failures[a] * costB > m_failures[b] * costA;
+  });
+
+  return order;
+}
+
+std::vector<unsigned> estimateAssertionCosts(SmtLibParser &parser) {
+  std::vector<unsigned> costs;
+  costs.reserve(parser.numAssertions());
+
+  for (sexpresso::Sexp &assertion : parser.assertions()) {
+    unsigned cost = 0;
+    for (sexpresso::SexpPostOrderView view :
+         sexpresso::SexpPostOrderRange(assertion)) {
+      (void)view;
+      ++cost;
+    }
+    costs.push_back(cost);
+  }
+
+  return costs;
+}
+
+} // namespace smt_jit
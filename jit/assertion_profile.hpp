@@ -0,0 +1,39 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace smt_jit {
+class SmtLibParser;
+
+// Counts how often each assertion of a formula rejects an assignment, based
+// on the results of smt_N (0 for models, otherwise the 1-based index of the
+// first failing assertion). Only the first failing assertion is observed, so
+// the counts depend on the order the profiled function checks them in.
+class AssertionProfile {
+  std::vector<size_t> m_failures;
+  size_t m_numSamples = 0;
+
+public:
+  explicit AssertionProfile(size_t numAssertions);
+
+  void record(llvm::ArrayRef<int> results);
+
+  size_t numSamples() const { return m_numSamples; }
+  size_t getFailures(unsigned assertionIdx) const {
+    return m_failures[assertionIdx];
+  }
+
+  // Returns the assertion indices ordered by decreasing number of failures per
+  // unit of cost, so that the assertions most likely to reject an assignment
+  // cheaply are checked first. Ties keep the file order.
+  std::vector<unsigned> computeOrder(llvm::ArrayRef<unsigned> costs) const;
+};
+
+// Estimates the evaluation cost of every assertion as the number of nodes of
+// its expression.
+std::vector<unsigned> estimateAssertionCosts(SmtLibParser &parser);
+
+} // namespace smt_jit
@@ -0,0 +1,49 @@
+#include "doctest.h"
+
+#include "assertion_profile.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+
+using namespace smt_jit;
+
+TEST_CASE("Test assertion_profile_record") {
+  AssertionProfile profile(3);
+  profile.record({0, 2, 2, 3, 0});
+  profile.record({2});
+
+  CHECK(profile.numSamples() == 6);
+  CHECK(profile.getFailures(0) == 0);
+  CHECK(profile.getFailures(1) == 3);
+  CHECK(profile.getFailures(2) == 1);
+}
+
+TEST_CASE("Test assertion_profile_order") {
+  AssertionProfile profile(4);
+  profile.record({4, 4, 4, 2, 2, 2, 3});
+
+  // Equal costs: most failures first, ties in file order.
+  std::vector<unsigned> order = profile.computeOrder({1, 1, 1, 1});
+  CHECK(order == std::vector<unsigned>{1, 3, 2, 0});
+
+  // Assertion 2 rejects fewer assignments than 4, but is much cheaper.
+  order = profile.computeOrder({1, 10, 1, 10});
+  CHECK(order == std::vector<unsigned>{2, 1, 3, 0});
+}
+
+TEST_CASE("Test assertion_costs") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    (assert (and (=  (_ bv1 8) (select  a (_ bv0 32) ) ) (=  (_ bv2 8) (select  a (_ bv1 32) ) ) ) )
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+  CHECK(parser.numAssertions() == 2);
+
+  const std::vector<unsigned> costs = estimateAssertionCosts(parser);
+  CHECK(costs.size() == 2);
+  CHECK(costs[0] > 0);
+  CHECK(costs[1] > costs[0]);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "bvlib/bvlib.h"
+
+// Hand-written assertion functions over a single packed 8-bit array `a`, in
+// place of jitted ones, for the evaluator tests.
+namespace smt_jit {
+namespace test {
+// Number of assertion checks made since the test last reset it.
+inline unsigned &numAssertionChecks() {
+  static unsigned numChecks = 0;
+  return numChecks;
+}
+
+inline bv_word selectByte(bv_array **arrays, bv_word idx) {
+  auto *arr = reinterpret_cast<bv_packed_array *>(arrays[0]);
+  return bvpa_select8(arr, 8, bv_mk(32, idx)).bits.data;
+}
+
+// (= (_ bv1 8) (select a (_ bv0 32)))
+inline int checkFirst(bv_array **arrays) {
+  ++numAssertionChecks();
+  return selectByte(arrays, 0) == 1;
+}
+} // namespace test
+} // namespace smt_jit
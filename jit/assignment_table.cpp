@@ -0,0 +1,106 @@
+#include "assignment_table.hpp"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "smtlib_parser.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace smt_jit {
+
+AssignmentTable::AssignmentTable(SmtLibParser &parser, bv_context *ctx,
+                                 bool verbose)
+    : m_numArrays(parser.numArrays()),
+      m_ctx(ctx ? ctx : bv_default_context()) {
+  m_arrays.reserve(parser.numAssignments() * m_numArrays);
+
+  for (size_t assignmentIdx = 0, e = parser.numAssignments();
+       assignmentIdx != e; ++assignmentIdx)
+    if (marshalAssignment(parser, assignmentIdx, verbose))
+      m_assignmentIdxs.push_back(assignmentIdx);
+
+  // Only take pointers to the array packs once all of them are in place.
+  assert(m_arrays.size() == m_assignmentIdxs.size() * m_numArrays);
+  m_packs.reserve(m_assignmentIdxs.size());
+  for (size_t i = 0, e = m_assignmentIdxs.size(); i != e; ++i)
+    m_packs.push_back(m_arrays.data() + i * m_numArrays);
+}
+
+std::vector<bv_array *> AssignmentTable::makeLaneBlocks(unsigned lanes) const {
+  assert(lanes > 0);
+  const size_t numBlocks = numLaneBlocks(lanes);
+  std::vector<bv_array *> blocks(numBlocks * m_numArrays * lanes);
+
+  for (size_t b = 0; b != numBlocks; ++b) {
+    bv_array **block = blocks.data() + b * m_numArrays * lanes;
+    for (unsigned l = 0; l != lanes; ++l) {
+      const size_t packIdx = std::min(b * lanes + l, size() - 1);
+      for (size_t a = 0; a != m_numArrays; ++a)
+        block[a * lanes + l] = m_packs[packIdx][a];
+    }
+  }
+
+  return blocks;
+}
+
+bool AssignmentTable::isFullAssignment(const SmtLibParser &parser,
+                                       size_t assignmentIdx, bool verbose) {
+  const Assignment &assignment = parser.assignments()[assignmentIdx];
+  const size_t numArrays = parser.numArrays();
+
+  if (verbose)
+    llvm::outs() << "Assignment " << assignmentIdx << ": ";
+
+  if (assignment.numVariables() != numArrays) {
+    if (verbose)
+      llvm::outs() << "wrong number of variables (" << assignment.numVariables()
+                   << " vs. " << numArrays << ")\n";
+    return false;
+  }
+
+  for (const ArrayInfo &ai : parser.arrays())
+    if (!assignment.hasVariable(ai.name)) {
+      if (verbose)
+        llvm::outs() << "partial assignment, " << ai.name << " missing\n";
+      return false;
+    }
+
+  return true;
+}
+
+size_t AssignmentTable::countFullAssignments(const SmtLibParser &parser) {
+  size_t res = 0;
+  for (size_t assignmentIdx = 0, e = parser.numAssignments();
+       assignmentIdx != e; ++assignmentIdx)
+    res += isFullAssignment(parser, assignmentIdx);
+
+  return res;
+}
+
+bool AssignmentTable::marshalAssignment(SmtLibParser &parser,
+                                        size_t assignmentIdx, bool verbose) {
+  if (!isFullAssignment(parser, assignmentIdx, verbose))
+    return false;
+
+  Assignment &assignment = parser.assignments()[assignmentIdx];
+  for (const ArrayInfo &ai : parser.arrays()) {
+    Assignment::AssignmentVector &arr = assignment.getValue(ai.name);
+    if (ai.isPacked()) {
+      bv_packed_array *bvpa_arr =
+          bvpa_mk_init_ctx(m_ctx, ai.element_width, arr.size(), arr.data());
+      m_arrays.push_back(reinterpret_cast<bv_array *>(bvpa_arr));
+    } else {
+      bv_array *bv_arr =
+          bva_mk_init_ctx(m_ctx, ai.element_width, arr.size(), arr.data());
+      m_arrays.push_back(bv_arr);
+    }
+  }
+
+  if (verbose)
+    llvm::outs() << "marshalled\n";
+
+  return true;
+}
+
+} // namespace smt_jit
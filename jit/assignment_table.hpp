@@ -0,0 +1,71 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include "bvlib/bvlib.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace smt_jit {
+class SmtLibParser;
+
+// Assignments of a single query converted to bvlib arrays exactly once, so
+// that the formula can be evaluated over and over again without allocating.
+// Each full assignment becomes a pack of array pointers, in the declaration
+// order of the arrays, that can be passed directly to the jitted formulas.
+// Packed arrays (see ArrayInfo::isPacked) are stored in the packs as
+// bv_packed_array pointers cast to bv_array pointers.
+//
+// The arrays are allocated in the given bvlib context and remain valid until
+// the context is reset or destroyed.
+class AssignmentTable {
+  std::vector<bv_array *> m_arrays;
+  std::vector<bv_array **> m_packs;
+  // Index of the parsed assignment corresponding to each pack.
+  std::vector<size_t> m_assignmentIdxs;
+  size_t m_numArrays = 0;
+  bv_context *m_ctx = nullptr;
+
+public:
+  // Uses the default bvlib context of the calling thread if ctx is null.
+  AssignmentTable(SmtLibParser &parser, bv_context *ctx = nullptr,
+                  bool verbose = false);
+
+  AssignmentTable(const AssignmentTable &) = delete;
+  AssignmentTable &operator=(const AssignmentTable &) = delete;
+
+  size_t size() const { return m_packs.size(); }
+  bool empty() const { return m_packs.empty(); }
+  size_t numArrays() const { return m_numArrays; }
+  bv_context *getContext() const { return m_ctx; }
+
+  bv_array ***packs() { return m_packs.data(); }
+  llvm::ArrayRef<bv_array **> packs() const { return m_packs; }
+
+  size_t getAssignmentIdx(size_t packIdx) const {
+    return m_assignmentIdxs[packIdx];
+  }
+
+  // Rearranges the packs into column-major blocks of `lanes` assignments, as
+  // expected by the lanes variant of jitted formulas: block b starts at
+  // b * numArrays() * lanes, and holds the array `a` of the pack
+  // b * lanes + l at offset a * lanes + l. The last block is padded by
+  // repeating the last pack.
+  std::vector<bv_array *> makeLaneBlocks(unsigned lanes) const;
+  size_t numLaneBlocks(unsigned lanes) const {
+    return (size() + lanes - 1) / lanes;
+  }
+
+  // Only full assignments, i.e., ones that assign all the declared arrays and
+  // nothing else, are marshalled.
+  static bool isFullAssignment(const SmtLibParser &parser,
+                               size_t assignmentIdx, bool verbose = false);
+  static size_t countFullAssignments(const SmtLibParser &parser);
+
+private:
+  bool marshalAssignment(SmtLibParser &parser, size_t assignmentIdx,
+                         bool verbose);
+};
+
+} // namespace smt_jit
@@ -0,0 +1,137 @@
+#include "doctest.h"
+
+#include "assignment_table.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+
+using namespace smt_jit;
+
+static bitvector select8(bv_array *arr, bv_word idx) {
+  return bvpa_select8(reinterpret_cast<bv_packed_array *>(arr), 8,
+                      bv_mk(32, idx));
+}
+
+TEST_CASE("Test assignment_table_packs") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    ; Assignments
+    ; { "a": [1, 2, 3], "b": [4, 5] }
+    ; { "b": [8], "a": [6, 7] }
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+  CHECK(parser.numAssignments() == 2);
+
+  bv_init_context();
+  AssignmentTable table(parser);
+  CHECK(table.size() == 2);
+  CHECK(table.numArrays() == 2);
+
+  bv_array **pack0 = table.packs()[0];
+  CHECK(pack0[0]->len == 3);
+  CHECK(bv_eq(select8(pack0[0], 2), bv_mk(8, 3)) == 1);
+  CHECK(pack0[1]->len == 2);
+
+  // Arrays are always packed in their declaration order.
+  bv_array **pack1 = table.packs()[1];
+  CHECK(pack1[0]->len == 2);
+  CHECK(bv_eq(select8(pack1[0], 1), bv_mk(8, 7)) == 1);
+  CHECK(pack1[1]->len == 1);
+  CHECK(bv_eq(select8(pack1[1], 0), bv_mk(8, 8)) == 1);
+
+  CHECK(table.getAssignmentIdx(0) == 0);
+  CHECK(table.getAssignmentIdx(1) == 1);
+  bv_teardown_context();
+}
+
+TEST_CASE("Test assignment_table_lane_blocks") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    ; Assignments
+    ; { "a": [0], "b": [10] }
+    ; { "a": [1], "b": [11] }
+    ; { "a": [2], "b": [12] }
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+
+  bv_init_context();
+  AssignmentTable table(parser);
+  CHECK(table.size() == 3);
+  CHECK(table.numLaneBlocks(2) == 2);
+
+  std::vector<bv_array *> blocks = table.makeLaneBlocks(2);
+  CHECK(blocks.size() == 2 * 2 * 2);
+  // Block 0: [a0, a1, b0, b1], block 1: [a2, a2, b2, b2].
+  const bv_word expected[] = {0, 1, 10, 11, 2, 2, 12, 12};
+  for (size_t i = 0; i != blocks.size(); ++i)
+    CHECK(select8(blocks[i], 0).bits.data == expected[i]);
+  bv_teardown_context();
+}
+
+TEST_CASE("Test assignment_table_explicit_context") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    ; Assignments
+    ; { "a": [42] }
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+
+  bv_context *ctx = bv_context_create();
+  {
+    AssignmentTable table(parser, ctx);
+    CHECK(table.getContext() == ctx);
+    CHECK(table.size() == 1);
+    CHECK(select8(table.packs()[0][0], 0).bits.data == 42);
+  }
+  bv_context_destroy(ctx);
+}
+
+TEST_CASE("Test assignment_table_wide_elements") {
+  std::string txt = R"(
+    (declare-fun w () (Array (_ BitVec 32) (_ BitVec 128) ) )
+    ; Assignments
+    ; { "w": [1, 2] }
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+  CHECK(!parser.arrays().front().isPacked());
+
+  bv_init_context();
+  AssignmentTable table(parser);
+  CHECK(table.size() == 1);
+  bv_array *arr = table.packs()[0][0];
+  CHECK(arr->len == 2);
+  CHECK(bv_eq(bva_select(arr, bv_mk(32, 1)), bv_mk(128, 2)) == 1);
+  bv_teardown_context();
+}
+
+TEST_CASE("Test assignment_table_skips_partial") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    ; Assignments
+    ; { "a": [1] }
+    ; { "a": [2], "c": [3] }
+    ; { "a": [4], "b": [5] }
+  )";
+
+  std::istringstream iss(txt);
+  smt_jit::SmtLibParser parser(iss);
+  CHECK(parser.numAssignments() == 3);
+
+  bv_init_context();
+  AssignmentTable table(parser);
+  CHECK(table.size() == 1);
+  CHECK(table.getAssignmentIdx(0) == 2);
+  CHECK(bv_eq(select8(table.packs()[0][1], 0), bv_mk(8, 5)) == 1);
+  bv_teardown_context();
+}
@@ -1,10 +1,25 @@
 #include "bvlib.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// The host library gets a separate context per thread, so that arrays can be
+// allocated concurrently by multiple evaluators. The bitcode loaded into the
+// JIT keeps a single global context, as the JIT does not support thread-local
+// storage.
+#if BVLIB_THREAD_LOCAL_CONTEXT == 1
+#define BVLIB_CONTEXT_STORAGE thread_local
+#else
+#define BVLIB_CONTEXT_STORAGE
+#endif
+
 #if BVLIB_ENABLE_ASSERTIONS == 1
 #include <cassert>
 #define BVLIB_ASSERT(...) assert(__VA_ARGS__)
@@ -50,48 +65,195 @@ constexpr bv_word maskLowerBits(bv_word n, bv_width width) {
   return (n >> width) << width;
 }
 
-struct BVContext {
-  char *memBegin = nullptr;
-  char *memEnd = nullptr;
-  char *memNext = nullptr;
-  static constexpr size_t PoolBytes = 1 << 24;
-  static constexpr size_t PoolWords = PoolBytes / BVWordBytes;
+constexpr bv_width packedElementBytes(bv_width width) {
+  if (width <= 8)
+    return 1;
+  if (width <= 16)
+    return 2;
+  if (width <= 32)
+    return 4;
+  return width <= BVWordBits ? 8 : 0;
+}
+
+// Same as numBitsNeeded, but lowers to a single leading zero count.
+inline bv_width numBitsNeededFast(bv_word n) {
+  return n == 0 ? 0 : BVWordBits - __builtin_clzll(n);
+}
+
+constexpr size_t roundUpToWord(size_t bytes) {
+  return (bytes + BVWordBytes - 1) / BVWordBytes * BVWordBytes;
+}
 
-  static BVContext &get() {
-    static BVContext ctx;
-    return ctx;
+// Header plus len elements and the default value, in bytes. Fails instead of
+// wrapping around.
+inline size_t arrayAllocBytes(size_t headerBytes, bv_width len,
+                              size_t elementBytes) {
+  const size_t numElements = size_t(len) + 1;
+  if (numElements == 0 ||
+      numElements > (SIZE_MAX - headerBytes) / elementBytes) {
+    fprintf(stderr, "bvlib: array of %u elements is too large\n", len);
+    abort();
   }
+  return headerBytes + numElements * elementBytes;
+}
 
-  bv_width remainingWords() const { return (memEnd - memNext) / BVWordBytes; }
+inline size_t arrayBytes(bv_width len) {
+  return arrayAllocBytes(sizeof(bv_array), len, sizeof(bitvector));
+}
 
-  [[ gnu::alloc_size(2), gnu::returns_nonnull ]] char *alloc_bytes(bv_width n) {
-    char *const ret = memNext;
+// Header of an arena chunk. The usable memory directly follows the header.
+struct BVChunk {
+  BVChunk *next;
+  size_t bytes;
 
-    const bv_width toBump = n + n % BVWordBytes;
-    BVLIB_ASSERT(toBump <= memEnd - memBegin);
-    memNext += toBump;
+  char *begin() { return reinterpret_cast<char *>(this + 1); }
+  char *end() { return begin() + bytes; }
+};
+static_assert(sizeof(BVChunk) % BVWordBytes == 0, "Chunk memory misaligned");
+
+// Bump allocator over a list of chunks that grows on demand. Reset only
+// rewinds to the first chunk, so the allocation functions must initialize all
+// the memory they hand out.
+struct BVContext {
+  static constexpr size_t DefaultChunkBytes = 1 << 20;
+  static constexpr size_t HugePageBytes = 1 << 21;
 
+  BVChunk *chunks = nullptr;
+  BVChunk *current = nullptr;
+  char *memNext = nullptr;
+  char *memEnd = nullptr;
+  size_t chunkBytes = DefaultChunkBytes;
+  bool hugePages = false;
+
+  [[ gnu::alloc_size(2), gnu::returns_nonnull ]] char *alloc_bytes(size_t n) {
+    // Leaves room for the chunk header and the huge page rounding.
+    if (n > SIZE_MAX - HugePageBytes - sizeof(BVChunk)) {
+      fprintf(stderr, "bvlib: allocation of %zu bytes is too large\n", n);
+      abort();
+    }
+    const size_t toBump = n == 0 ? BVWordBytes : roundUpToWord(n);
+    if (static_cast<size_t>(memEnd - memNext) < toBump)
+      nextChunk(toBump);
+
+    char *const ret = memNext;
+    memNext += toBump;
     return ret;
   }
 
-  char *alloc_words(bv_width n) {
-    BVLIB_ASSERT(remainingWords() >= n);
-    return alloc_bytes(n * BVWordBytes);
+  // Continues in the first following chunk that fits minBytes. Chunks that
+  // are too small stay unused until the next reset.
+  void nextChunk(size_t minBytes) {
+    BVChunk *prev = current;
+    BVChunk *next = current ? current->next : chunks;
+    while (next && next->bytes < minBytes) {
+      prev = next;
+      next = next->next;
+    }
+
+    if (!next) {
+      next = allocChunk(minBytes > chunkBytes ? minBytes : chunkBytes);
+      if (prev)
+        prev->next = next;
+      else
+        chunks = next;
+    }
+
+    current = next;
+    memNext = next->begin();
+    memEnd = next->end();
+  }
+
+  BVChunk *allocChunk(size_t bytes) {
+    size_t totalBytes = sizeof(BVChunk) + bytes;
+    void *mem = nullptr;
+
+    if (hugePages) {
+      totalBytes = (totalBytes + HugePageBytes - 1) / HugePageBytes *
+                   HugePageBytes;
+      if (posix_memalign(&mem, HugePageBytes, totalBytes) != 0)
+        mem = nullptr;
+#ifdef MADV_HUGEPAGE
+      if (mem)
+        madvise(mem, totalBytes, MADV_HUGEPAGE);
+#endif
+    } else {
+      mem = malloc(totalBytes);
+    }
+
+    if (!mem) {
+      fprintf(stderr, "bvlib: out of memory allocating %zu bytes\n",
+              totalBytes);
+      abort();
+    }
+
+    BVChunk *chunk = static_cast<BVChunk *>(mem);
+    chunk->next = nullptr;
+    chunk->bytes = totalBytes - sizeof(BVChunk);
+    return chunk;
   }
 
-  void init() {
-    memNext = memBegin = (char *)calloc(PoolWords, BVWordBytes);
-    memEnd = memBegin + PoolBytes;
+  void init(size_t newChunkBytes = DefaultChunkBytes,
+            bool useHugePages = false) {
+    teardown();
+    chunkBytes = newChunkBytes != 0 ? newChunkBytes : DefaultChunkBytes;
+    hugePages = useHugePages;
   }
 
   void reset() {
-    memset(memBegin, 0, (memNext - memBegin) * BVWordBytes);
-    memNext = memBegin;
+    current = nullptr;
+    memNext = memEnd = nullptr;
+  }
+
+  // Frees the chunks not used since the last reset.
+  void trim() {
+    BVChunk **link = current ? &current->next : &chunks;
+    freeChunks(*link);
+    *link = nullptr;
   }
 
-  void teardown() { free(memBegin); }
+  void teardown() {
+    freeChunks(chunks);
+    chunks = nullptr;
+    reset();
+  }
+
+  static void freeChunks(BVChunk *chunk) {
+    while (chunk) {
+      BVChunk *next = chunk->next;
+      free(chunk);
+      chunk = next;
+    }
+  }
+};
+
+template <typename ElementT>
+bitvector packedSelect(bv_packed_array *arr, bv_width width, bitvector n) {
+  BVLIB_ASSERT(arr);
+  BVLIB_ASSERT(n.occupied_width < BVWordBits);
+  BVLIB_ASSERT(packedElementBytes(width) == sizeof(ElementT));
+
+  const bv_word i = n.bits.data;
+  const bv_word idx = i < arr->len ? i : arr->len;
+
+  ElementT element;
+  memcpy(&element, arr->bytes + idx * sizeof(ElementT), sizeof(ElementT));
+  const bv_word bits = element;
+
+  bitvector res = {width, numBitsNeededFast(bits), {bits}};
+  return res;
+}
+
+} // namespace
+
+struct bv_context_t {
+  BVContext arena;
 };
 
+namespace {
+bv_context *defaultContext() {
+  static BVLIB_CONTEXT_STORAGE bv_context ctx;
+  return &ctx;
+}
 } // namespace
 
 extern "C" {
@@ -261,23 +423,25 @@ bitvector bv_sext(bitvector n, bv_width width) {
   return res;
 }
 
-bv_array *bva_mk(bv_width width, bv_width len) {
-  bv_width wordsToAlloc = len + 4;
-  char *bytes = BVContext::get().alloc_words(wordsToAlloc);
+bv_array *bva_mk_ctx(bv_context *ctx, bv_width width, bv_width len) {
+  BVLIB_ASSERT(ctx);
+
+  char *bytes = ctx->arena.alloc_bytes(arrayBytes(len));
   bv_array *arr = (bv_array *)bytes;
   arr->len = len;
 
-  for (bv_width i = 0; i != len + 1; ++i)
-    arr->values[i].width = width;
+  for (size_t i = 0, e = size_t(len) + 1; i != e; ++i)
+    arr->values[i] = {width, 0, {0}};
 
   return arr;
 }
 
-bv_array *bva_mk_init(bv_width width, bv_width len, bv_word *constants) {
+bv_array *bva_mk_init_ctx(bv_context *ctx, bv_width width, bv_width len,
+                          bv_word *constants) {
+  BVLIB_ASSERT(ctx);
   BVLIB_ASSERT(constants);
 
-  bv_width wordsToAlloc = len + 4;
-  char *bytes = BVContext::get().alloc_words(wordsToAlloc);
+  char *bytes = ctx->arena.alloc_bytes(arrayBytes(len));
   bv_array *arr = (bv_array *)bytes;
   arr->len = len;
 
@@ -285,7 +449,7 @@ bv_array *bva_mk_init(bv_width width, bv_width len, bv_word *constants) {
     if (constants[i] != 0)
       arr->values[i] = bv_mk(width, constants[i]);
     else
-      arr->values[i].width = width;
+      arr->values[i] = {width, 0, {0}};
   }
 
   arr->values[len] = bv_zero();
@@ -293,9 +457,105 @@ bv_array *bva_mk_init(bv_width width, bv_width len, bv_word *constants) {
   return arr;
 }
 
-void bv_init_context() { BVContext::get().init(); }
-void bv_reset_context() { BVContext::get().reset(); }
-void bv_teardown_context() { BVContext::get().teardown(); }
+bv_array *bva_mk(bv_width width, bv_width len) {
+  return bva_mk_ctx(defaultContext(), width, len);
+}
+
+bv_array *bva_mk_init(bv_width width, bv_width len, bv_word *constants) {
+  return bva_mk_init_ctx(defaultContext(), width, len, constants);
+}
+
+bv_width bvpa_element_bytes(bv_width width) {
+  return packedElementBytes(width);
+}
+
+bv_packed_array *bvpa_mk_ctx(bv_context *ctx, bv_width width, bv_width len) {
+  BVLIB_ASSERT(ctx);
+  const bv_width elementBytes = packedElementBytes(width);
+  BVLIB_ASSERT(elementBytes != 0);
+
+  // Allocate one extra (zero) element for the default array value.
+  const size_t bytes = arrayAllocBytes(BVWordBytes, len, elementBytes);
+  char *mem = ctx->arena.alloc_bytes(bytes);
+  bv_packed_array *arr = (bv_packed_array *)mem;
+  arr->len = len;
+  memset(arr->bytes, 0, (size_t(len) + 1) * elementBytes);
+
+  return arr;
+}
+
+bv_packed_array *bvpa_mk_init_ctx(bv_context *ctx, bv_width width,
+                                  bv_width len, bv_word *constants) {
+  BVLIB_ASSERT(constants);
+
+  bv_packed_array *arr = bvpa_mk_ctx(ctx, width, len);
+  const bv_width elementBytes = packedElementBytes(width);
+
+  for (bv_width i = 0; i != len; ++i) {
+    const bv_word n = maskOverflow(constants[i], width);
+    // The storage is little-endian, just like the host.
+    memcpy(arr->bytes + size_t(i) * elementBytes, &n, elementBytes);
+  }
+
+  return arr;
+}
+
+bv_packed_array *bvpa_mk_raw_ctx(bv_context *ctx, bv_width width,
+                                 bv_width len, const void *values) {
+  BVLIB_ASSERT(values || len == 0);
+
+  bv_packed_array *arr = bvpa_mk_ctx(ctx, width, len);
+  if (len != 0)
+    memcpy(arr->bytes, values, size_t(len) * packedElementBytes(width));
+
+  return arr;
+}
+
+bv_packed_array *bvpa_mk(bv_width width, bv_width len) {
+  return bvpa_mk_ctx(defaultContext(), width, len);
+}
+
+bv_packed_array *bvpa_mk_init(bv_width width, bv_width len,
+                              bv_word *constants) {
+  return bvpa_mk_init_ctx(defaultContext(), width, len, constants);
+}
+
+bv_packed_array *bvpa_mk_raw(bv_width width, bv_width len,
+                             const void *values) {
+  return bvpa_mk_raw_ctx(defaultContext(), width, len, values);
+}
+
+bv_context *bv_context_create() { return bv_context_create_ex(0, 0); }
+
+bv_context *bv_context_create_ex(bv_word chunk_bytes, int huge_pages) {
+  bv_context *ctx = new bv_context;
+  ctx->arena.init(chunk_bytes, huge_pages != 0);
+  return ctx;
+}
+
+void bv_context_reset(bv_context *ctx) {
+  BVLIB_ASSERT(ctx);
+  ctx->arena.reset();
+}
+
+void bv_context_trim(bv_context *ctx) {
+  BVLIB_ASSERT(ctx);
+  ctx->arena.trim();
+}
+
+void bv_context_destroy(bv_context *ctx) {
+  if (!ctx)
+    return;
+
+  ctx->arena.teardown();
+  delete ctx;
+}
+
+bv_context *bv_default_context() { return defaultContext(); }
+
+void bv_init_context() { defaultContext()->arena.init(); }
+void bv_reset_context() { defaultContext()->arena.reset(); }
+void bv_teardown_context() { defaultContext()->arena.teardown(); }
 
 bitvector bva_select(bv_array *arr, bitvector n) {
   BVLIB_ASSERT(arr);
@@ -307,6 +567,22 @@ bitvector bva_select(bv_array *arr, bitvector n) {
   return arr->values[idx];
 }
 
+bitvector bvpa_select8(bv_packed_array *arr, bv_width width, bitvector n) {
+  return packedSelect<unsigned char>(arr, width, n);
+}
+
+bitvector bvpa_select16(bv_packed_array *arr, bv_width width, bitvector n) {
+  return packedSelect<unsigned short>(arr, width, n);
+}
+
+bitvector bvpa_select32(bv_packed_array *arr, bv_width width, bitvector n) {
+  return packedSelect<unsigned>(arr, width, n);
+}
+
+bitvector bvpa_select64(bv_packed_array *arr, bv_width width, bitvector n) {
+  return packedSelect<bv_word>(arr, width, n);
+}
+
 void bv_fprint(void *file, bitvector v) {
   BVLIB_ASSERT(v.occupied_width <= BVWordBits);
 
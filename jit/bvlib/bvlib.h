@@ -26,6 +26,21 @@ struct bv_array_t {
 };
 typedef struct bv_array_t bv_array;
 
+// Arrays of elements up to 64 bits wide, stored in their natural byte width
+// (1, 2, 4, or 8 bytes per element) instead of full bitvectors.
+struct bv_packed_array_t {
+  bv_word len;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wc99-extensions"
+  unsigned char bytes[];
+#pragma clang diagnostic pop
+};
+typedef struct bv_packed_array_t bv_packed_array;
+
+// Opaque handle to a memory pool for bitvector arrays. Independent contexts
+// can be used concurrently, e.g., one per evaluator thread.
+typedef struct bv_context_t bv_context;
+
 bitvector bv_zero();
 bitvector bv_one();
 bitvector bv_bool(int b);
@@ -51,11 +66,54 @@ bitvector bv_extract(bitvector a, bv_width from, bv_width to);
 bitvector bv_zext(bitvector n, bv_width width);
 bitvector bv_sext(bitvector n, bv_width width);
 
+// Contexts allocate memory in chunks of (by default) 1 MiB on demand. Reset
+// keeps the chunks for reuse without clearing them; trim frees the chunks not
+// used since the last reset.
+bv_context *bv_context_create();
+// A chunk_bytes of 0 selects the default chunk size. Non-zero huge_pages
+// requests transparent huge pages for the chunks, where supported.
+bv_context *bv_context_create_ex(bv_word chunk_bytes, int huge_pages);
+void bv_context_reset(bv_context *ctx);
+void bv_context_trim(bv_context *ctx);
+void bv_context_destroy(bv_context *ctx);
+// The implicit context of the calling thread, used by the functions below that
+// do not take an explicit context, e.g., bva_mk.
+bv_context *bv_default_context();
+
+bv_array *bva_mk_ctx(bv_context *ctx, bv_width width, bv_width len);
+bv_array *bva_mk_init_ctx(bv_context *ctx, bv_width width, bv_width len,
+                          bv_word *constants);
+
 bv_array *bva_mk(bv_width width, bv_width len);
 bv_array *bva_mk_init(bv_width width, bv_width len, bv_word *constants);
 
 bitvector bva_select(bv_array *arr, bitvector n);
 
+// Bytes per element of packed arrays of the given element width, or 0 if the
+// elements are too wide to be packed.
+bv_width bvpa_element_bytes(bv_width width);
+
+bv_packed_array *bvpa_mk_ctx(bv_context *ctx, bv_width width, bv_width len);
+bv_packed_array *bvpa_mk_init_ctx(bv_context *ctx, bv_width width,
+                                  bv_width len, bv_word *constants);
+// Copies len elements of bvpa_element_bytes(width) bytes each, e.g., KLEE's
+// byte arrays.
+bv_packed_array *bvpa_mk_raw_ctx(bv_context *ctx, bv_width width,
+                                 bv_width len, const void *values);
+
+bv_packed_array *bvpa_mk(bv_width width, bv_width len);
+bv_packed_array *bvpa_mk_init(bv_width width, bv_width len,
+                              bv_word *constants);
+bv_packed_array *bvpa_mk_raw(bv_width width, bv_width len, const void *values);
+
+// Width is the declared element width; the suffix is the element storage size
+// in bits.
+bitvector bvpa_select8(bv_packed_array *arr, bv_width width, bitvector n);
+bitvector bvpa_select16(bv_packed_array *arr, bv_width width, bitvector n);
+bitvector bvpa_select32(bv_packed_array *arr, bv_width width, bitvector n);
+bitvector bvpa_select64(bv_packed_array *arr, bv_width width, bitvector n);
+
+// Manage the default context of the calling thread.
 void bv_init_context();
 void bv_reset_context();
 void bv_teardown_context();
@@ -3,6 +3,7 @@
 #include "bvlib.h"
 
 #include <cstdio>
+#include <vector>
 
 TEST_CASE("Test bv_mk") {
   bitvector v = bv_mk(8, 12);
@@ -446,3 +447,150 @@ TEST_CASE("Test bva_mk_multiple") {
 
   bv_teardown_context();
 }
+
+TEST_CASE("Test bvpa_element_bytes") {
+  CHECK(bvpa_element_bytes(1) == 1);
+  CHECK(bvpa_element_bytes(8) == 1);
+  CHECK(bvpa_element_bytes(9) == 2);
+  CHECK(bvpa_element_bytes(16) == 2);
+  CHECK(bvpa_element_bytes(32) == 4);
+  CHECK(bvpa_element_bytes(63) == 8);
+  CHECK(bvpa_element_bytes(64) == 8);
+  CHECK(bvpa_element_bytes(65) == 0);
+}
+
+TEST_CASE("Test bvpa_mk_init8") {
+  bv_init_context();
+
+  bv_word numbers[5] = {1, 2, 3, 0, 255};
+
+  bv_packed_array *arr = bvpa_mk_init(8, 5, numbers);
+  CHECK(arr != nullptr);
+  CHECK(arr->len == 5);
+
+  for (size_t i = 0; i != 5; ++i) {
+    bitvector a = bvpa_select8(arr, 8, bv_mk(32, i));
+    CHECK(a.width == 8);
+    CHECK(bv_eq(a, bv_mk(8, numbers[i])) == 1);
+    CHECK(a.occupied_width == bv_mk(8, numbers[i]).occupied_width);
+  }
+
+  // Out of bounds accesses return the default value.
+  CHECK(bvpa_select8(arr, 8, bv_mk(32, 5)).bits.data == 0);
+  CHECK(bvpa_select8(arr, 8, bv_mk(32, 1000)).bits.data == 0);
+
+  bv_teardown_context();
+}
+
+TEST_CASE("Test bvpa_mk_init_wide") {
+  bv_init_context();
+
+  bv_word numbers[3] = {1234, 0, 65535};
+  bv_packed_array *arr16 = bvpa_mk_init(16, 3, numbers);
+  bv_packed_array *arr32 = bvpa_mk_init(32, 3, numbers);
+  bv_packed_array *arr64 = bvpa_mk_init(64, 3, numbers);
+
+  for (size_t i = 0; i != 3; ++i) {
+    CHECK(bvpa_select16(arr16, 16, bv_mk(32, i)).bits.data == numbers[i]);
+    CHECK(bvpa_select32(arr32, 32, bv_mk(32, i)).bits.data == numbers[i]);
+    CHECK(bvpa_select64(arr64, 64, bv_mk(32, i)).bits.data == numbers[i]);
+  }
+
+  CHECK(bvpa_select16(arr16, 16, bv_mk(32, 3)).bits.data == 0);
+  CHECK(bvpa_select32(arr32, 32, bv_mk(32, 7)).bits.data == 0);
+  CHECK(bvpa_select64(arr64, 64, bv_mk(32, 3)).bits.data == 0);
+
+  bv_teardown_context();
+}
+
+TEST_CASE("Test bvpa_mk_raw") {
+  bv_init_context();
+
+  const unsigned char bytes[4] = {'e', 'c', 'h', 'o'};
+  bv_packed_array *arr = bvpa_mk_raw(8, 4, bytes);
+  CHECK(arr->len == 4);
+
+  for (size_t i = 0; i != 4; ++i)
+    CHECK(bvpa_select8(arr, 8, bv_mk(32, i)).bits.data == bytes[i]);
+  CHECK(bvpa_select8(arr, 8, bv_mk(32, 4)).bits.data == 0);
+
+  bv_packed_array *empty = bvpa_mk_raw(8, 0, nullptr);
+  CHECK(empty->len == 0);
+  CHECK(bvpa_select8(empty, 8, bv_mk(32, 0)).bits.data == 0);
+
+  bv_teardown_context();
+}
+
+TEST_CASE("Test bv_context_independent") {
+  bv_context *ctx1 = bv_context_create();
+  bv_context *ctx2 = bv_context_create();
+  CHECK(ctx1 != nullptr);
+  CHECK(ctx2 != nullptr);
+  CHECK(ctx1 != ctx2);
+  CHECK(ctx1 != bv_default_context());
+
+  bv_word numbers[3] = {1, 2, 3};
+  bv_array *arr1 = bva_mk_init_ctx(ctx1, 16, 3, numbers);
+  bv_packed_array *arr2 = bvpa_mk_init_ctx(ctx2, 8, 3, numbers);
+
+  // Resetting one context does not affect arrays of the other one.
+  bv_context_reset(ctx1);
+  for (size_t i = 0; i != 3; ++i)
+    CHECK(bvpa_select8(arr2, 8, bv_mk(32, i)).bits.data == numbers[i]);
+
+  arr1 = bva_mk_ctx(ctx1, 16, 3);
+  CHECK(arr1->len == 3);
+  for (size_t i = 0; i != 3; ++i)
+    CHECK(bva_select(arr1, bv_mk(32, i)).bits.data == 0);
+
+  bv_context_destroy(ctx1);
+  bv_context_destroy(ctx2);
+  bv_context_destroy(nullptr);
+}
+
+TEST_CASE("Test bv_context_growth") {
+  // Small chunks force the arena to grow, and the wide array needs a chunk
+  // of its own.
+  bv_context *ctx = bv_context_create_ex(256, 0);
+
+  bv_word numbers[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  std::vector<bv_array *> arrays;
+  for (size_t i = 0; i != 100; ++i) {
+    numbers[0] = i;
+    arrays.push_back(bva_mk_init_ctx(ctx, 16, 8, numbers));
+  }
+  bv_array *wide = bva_mk_ctx(ctx, 16, 1000);
+
+  // Consecutive arrays must not overlap.
+  for (size_t i = 0; i != arrays.size(); ++i) {
+    CHECK(bva_select(arrays[i], bv_mk(32, 0)).bits.data == i);
+    CHECK(bva_select(arrays[i], bv_mk(32, 7)).bits.data == 8);
+  }
+  CHECK(wide->len == 1000);
+  CHECK(bva_select(wide, bv_mk(32, 999)).bits.data == 0);
+
+  // Reset rewinds to the first chunk, and the memory handed out again is
+  // initialized even though reset does not clear it.
+  bv_context_reset(ctx);
+  bv_array *reused = bva_mk_ctx(ctx, 16, 8);
+  CHECK(reused == arrays[0]);
+  for (size_t i = 0; i != 8; ++i)
+    CHECK(bva_select(reused, bv_mk(32, i)).bits.data == 0);
+
+  bv_context_trim(ctx);
+  bv_array *next = bva_mk_init_ctx(ctx, 16, 8, numbers);
+  CHECK(bva_select(next, bv_mk(32, 7)).bits.data == 8);
+  CHECK(bva_select(reused, bv_mk(32, 7)).bits.data == 0);
+
+  bv_context_destroy(ctx);
+}
+
+TEST_CASE("Test bv_context_huge_pages") {
+  bv_context *ctx = bv_context_create_ex(0, 1);
+
+  bv_packed_array *arr = bvpa_mk_ctx(ctx, 8, 1 << 22);
+  CHECK(arr->len == (1 << 22));
+  CHECK(bvpa_select8(arr, 8, bv_mk(32, (1 << 22) - 1)).bits.data == 0);
+
+  bv_context_destroy(ctx);
+}
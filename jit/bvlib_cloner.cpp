@@ -3,10 +3,12 @@
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/InstIterator.h"
 
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include <fstream>
@@ -22,7 +24,7 @@ std::unique_ptr<llvm::Module> CloneDeclarationsAndPrepare(llvm::Module &M) {
 
     if ((func.getInstructionCount() <= 28 &&
          !func.getName().contains("context")) ||
-        func.getName() == "bv_mk")
+        func.getName() == "bv_mk" || func.getName().startswith("bvpa_select"))
       func.addFnAttr(Attribute::AlwaysInline);
 
     func.setLinkage(GlobalValue::LinkageTypes::ExternalLinkage);
@@ -55,8 +57,75 @@ std::unique_ptr<llvm::Module> CloneDeclarationsAndPrepare(llvm::Module &M) {
   return std::move(origCloned);
 }
 
-std::unique_ptr<Module> CloneBVLibTemplate(const Module &M) {
-  return llvm::CloneModule(M);
+std::unique_ptr<Module> CreateFormulaModule(const Module &bvLib) {
+  auto M = llvm::make_unique<Module>(bvLib.getModuleIdentifier(),
+                                     bvLib.getContext());
+  M->setDataLayout(bvLib.getDataLayout());
+  M->setTargetTriple(bvLib.getTargetTriple());
+  return M;
+}
+
+// Adds the global values used by the constant to globals.
+static void collectGlobals(const Constant *C,
+                           SmallPtrSetImpl<const GlobalValue *> &globals) {
+  if (auto *GV = dyn_cast<GlobalValue>(C)) {
+    globals.insert(GV);
+    return;
+  }
+
+  for (const Use &op : C->operands())
+    if (auto *opC = dyn_cast<Constant>(op))
+      collectGlobals(opC, globals);
+}
+
+Function *ImportBVLibFunction(const Module &bvLib, Module &M, StringRef name) {
+  if (Function *existing = M.getFunction(name))
+    return existing;
+
+  Function *orig = bvLib.getFunction(name);
+  if (!orig)
+    return nullptr;
+
+  Function *func = Function::Create(orig->getFunctionType(), orig->getLinkage(),
+                                    orig->getName(), &M);
+  func->copyAttributesFrom(orig);
+  if (orig->isDeclaration())
+    return func;
+
+  // Import everything the body refers to first, so that the cloned body only
+  // refers to M.
+  SmallPtrSet<const GlobalValue *, 8> globals;
+  for (const Instruction &I : instructions(orig))
+    for (const Use &op : I.operands())
+      if (auto *C = dyn_cast<Constant>(op))
+        collectGlobals(C, globals);
+
+  ValueToValueMapTy VMap;
+  for (const GlobalValue *GV : globals) {
+    if (auto *callee = dyn_cast<Function>(GV)) {
+      VMap[callee] = ImportBVLibFunction(bvLib, M, callee->getName());
+      continue;
+    }
+
+    auto *global = cast<GlobalVariable>(GV);
+    GlobalVariable *decl = M.getGlobalVariable(global->getName());
+    if (!decl)
+      decl = new GlobalVariable(M, global->getValueType(), global->isConstant(),
+                                GlobalValue::ExternalLinkage, nullptr,
+                                global->getName());
+    VMap[global] = decl;
+  }
+
+  auto argIt = func->arg_begin();
+  for (const Argument &arg : orig->args()) {
+    argIt->setName(arg.getName());
+    VMap[&arg] = &*argIt++;
+  }
+
+  SmallVector<ReturnInst *, 4> returns;
+  CloneFunctionInto(func, orig, VMap, /* ModuleLevelChanges = */ true,
+                    returns);
+  return func;
 }
 
 void SaveIRToFile(const llvm::Module &M, Twine path) {
@@ -1,3 +1,4 @@
+#include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/IR/Module.h"
 
@@ -7,7 +8,17 @@ namespace smt_jit {
 
 std::unique_ptr<llvm::Module> CloneDeclarationsAndPrepare(llvm::Module &M);
 
-std::unique_ptr<llvm::Module> CloneBVLibTemplate(const llvm::Module &M);
+// Creates an empty module for a formula, with the target of the bvlib
+// template. The bvlib functions are imported on first use, with
+// ImportBVLibFunction.
+std::unique_ptr<llvm::Module> CreateFormulaModule(const llvm::Module &bvLib);
+
+// Returns the bvlib function name in M, importing it from the bvlib template
+// first if needed: always inlined functions are imported with their bodies,
+// and the remaining ones as declarations. Returns nullptr for functions that
+// are not in the template.
+llvm::Function *ImportBVLibFunction(const llvm::Module &bvLib, llvm::Module &M,
+                                    llvm::StringRef name);
 
 void SaveIRToFile(const llvm::Module &M, llvm::Twine path);
 
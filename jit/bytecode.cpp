@@ -0,0 +1,474 @@
+#include "bytecode.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include "assignment_table.hpp"
+#include "smtlib_parser.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+
+namespace smt_jit {
+
+using namespace llvm;
+using namespace sexpresso;
+
+namespace {
+// Operand of the compile-time stack that mirrors the value stack of
+// Smt2LLVM::lowerAssert.
+struct Operand {
+  enum Kind { Integer, Bool, BitVector, Array };
+
+  Kind kind;
+  // Register of Bool and BitVector operands, index of Array operands.
+  unsigned reg;
+  // Value of Integer operands.
+  long long value;
+};
+
+class BytecodeCompiler {
+  SmtLibParser &m_parser;
+  std::vector<Instruction> &m_code;
+  std::vector<bitvector> &m_constants;
+  unsigned m_numTemporaries = 0;
+
+  StringMap<unsigned> m_arrayIdxs;
+  SmallVector<Operand, 8> m_stack;
+  // Temporaries are numbered from 0 while compiling, and placed after the
+  // constants once their final number is known.
+  static constexpr unsigned TemporaryBit = 1u << 31;
+
+public:
+  BytecodeCompiler(SmtLibParser &parser, std::vector<Instruction> &code,
+                   std::vector<bitvector> &constants)
+      : m_parser(parser), m_code(code), m_constants(constants) {
+    unsigned i = 0;
+    for (const ArrayInfo &ai : m_parser.arrays())
+      m_arrayIdxs[ai.name] = i++;
+  }
+
+  unsigned compile() {
+    for (size_t i = 0, e = m_parser.numAssertions(); i != e; ++i)
+      compileAssert(i);
+    m_code.push_back({Opcode::Halt, 0, 0, 0, 0});
+
+    // Relocate the temporaries past the constants.
+    const unsigned numConstants = m_constants.size();
+    auto relocate = [numConstants](unsigned &reg) {
+      if (reg & TemporaryBit)
+        reg = (reg & ~TemporaryBit) + numConstants;
+    };
+    for (Instruction &inst : m_code) {
+      relocate(inst.dst);
+      if (inst.op == Opcode::Assert) {
+        relocate(inst.a);
+        continue;
+      }
+      if (!isSelect(inst.op))
+        relocate(inst.a);
+      if (inst.op != Opcode::Extract && inst.op != Opcode::ZExt &&
+          inst.op != Opcode::SExt)
+        relocate(inst.b);
+    }
+
+    return numConstants + m_numTemporaries;
+  }
+
+private:
+  static bool isSelect(Opcode op) {
+    return op >= Opcode::Select && op <= Opcode::PackedSelect64;
+  }
+
+  void push(Operand op) { m_stack.push_back(op); }
+  Operand pop() {
+    assert(!m_stack.empty());
+    return m_stack.pop_back_val();
+  }
+
+  Operand pushInteger(long long value) {
+    Operand op = {Operand::Integer, 0, value};
+    push(op);
+    return op;
+  }
+
+  unsigned newTemporary() { return TemporaryBit | m_numTemporaries++; }
+
+  unsigned newConstant(bitvector value) {
+    m_constants.push_back(value);
+    return m_constants.size() - 1;
+  }
+
+  Operand boolConstant(bool value) {
+    bitvector bv = {1, value ? 1u : 0u, {value ? 1ull : 0ull}};
+    return {Operand::Bool, newConstant(bv), 0};
+  }
+
+  Operand emit(Opcode op, Operand::Kind kind, unsigned a, unsigned b = 0,
+               unsigned c = 0) {
+    const unsigned dst = newTemporary();
+    m_code.push_back({op, dst, a, b, c});
+    return {kind, dst, 0};
+  }
+
+  unsigned integerValue(const Operand &op) {
+    assert(op.kind == Operand::Integer && "Expected an integer constant");
+    return static_cast<unsigned>(op.value);
+  }
+
+  void compileBinaryBV(Opcode op) {
+    Operand rhs = pop();
+    Operand lhs = pop();
+    assert(lhs.kind == Operand::BitVector && rhs.kind == Operand::BitVector);
+    push(emit(op, Operand::BitVector, lhs.reg, rhs.reg));
+  }
+
+  void compileCompare(Opcode op) {
+    Operand rhs = pop();
+    Operand lhs = pop();
+    assert(lhs.kind == Operand::BitVector && rhs.kind == Operand::BitVector);
+    push(emit(op, Operand::Bool, lhs.reg, rhs.reg));
+  }
+
+  void compileBoolean(Opcode op) {
+    Operand rhs = pop();
+    Operand lhs = pop();
+    assert(lhs.kind == Operand::Bool && rhs.kind == Operand::Bool);
+    push(emit(op, Operand::Bool, lhs.reg, rhs.reg));
+  }
+
+  void compileEq() {
+    Operand rhs = pop();
+    Operand lhs = pop();
+    assert(lhs.kind == rhs.kind);
+
+    if (lhs.kind == Operand::Integer)
+      push(boolConstant(lhs.value == rhs.value));
+    else if (lhs.kind == Operand::Bool)
+      push(emit(Opcode::BoolEq, Operand::Bool, lhs.reg, rhs.reg));
+    else
+      push(emit(Opcode::Eq, Operand::Bool, lhs.reg, rhs.reg));
+  }
+
+  void compileSelect() {
+    Operand index = pop();
+    Operand arr = pop();
+    assert(arr.kind == Operand::Array);
+    assert(index.kind == Operand::BitVector);
+
+    const ArrayInfo &ai = m_parser.arrays()[arr.reg];
+    if (!ai.isPacked()) {
+      push(emit(Opcode::Select, Operand::BitVector, arr.reg, index.reg));
+      return;
+    }
+
+    const unsigned width = ai.element_width;
+    const Opcode op = width <= 8    ? Opcode::PackedSelect8
+                      : width <= 16 ? Opcode::PackedSelect16
+                      : width <= 32 ? Opcode::PackedSelect32
+                                    : Opcode::PackedSelect64;
+    push(emit(op, Operand::BitVector, arr.reg, index.reg, width));
+  }
+
+  void compileAssert(unsigned idx) {
+    assert(idx < m_parser.numAssertions());
+    Sexp &assertion = m_parser.assertions()[idx];
+
+    m_stack.clear();
+    StringMap<Operand> letToVal;
+
+    for (SexpPostOrderView view : SexpPostOrderRange(assertion)) {
+      assert(view.sexp);
+      assert(view.sexp->isString());
+      StringRef str = view.sexp->getString();
+
+      assert(view.parent);
+      Sexp &parent = *view.parent;
+
+      if (!view.isHead()) {
+        if (str == "extract" || str == "zero_extend" || str == "sign_extend") {
+          assert(view.getHead().getString() == "_");
+          continue;
+        }
+
+        if (view.sexp->isNumber()) {
+          pushInteger(view.sexp->toNumber());
+          continue;
+        }
+
+        if (str == "false") {
+          push(boolConstant(false));
+          continue;
+        }
+
+        if (str.startswith("bv")) {
+          StringRef remainder = str.substr(2);
+          assert(!remainder.empty() &&
+                 std::all_of(remainder.begin(), remainder.end(), ::isdigit));
+          pushInteger(std::stoll(remainder.str()));
+          continue;
+        }
+
+        auto letIt = letToVal.find(str);
+        if (letIt != letToVal.end()) {
+          push(letIt->second);
+          continue;
+        }
+
+        auto arrIt = m_arrayIdxs.find(str);
+        if (arrIt != m_arrayIdxs.end()) {
+          push({Operand::Array, arrIt->second, 0});
+          continue;
+        }
+
+        llvm::errs() << "Operand \"" << str << "\" not handled!\n";
+        llvm_unreachable("Unknown symbol");
+      }
+
+      if (str == "_") {
+        assert(parent.childCount() > 1);
+        assert(parent.getChild(1).isString());
+        StringRef realFn = parent.getChild(1).getString();
+        if (realFn.startswith("bv")) {
+          const unsigned width = integerValue(pop());
+          const Operand constant = pop();
+          assert(constant.kind == Operand::Integer);
+          const unsigned reg = newConstant(
+              bv_mk(width, static_cast<bv_word>(constant.value)));
+          push({Operand::BitVector, reg, 0});
+        } else if (realFn == "extract") {
+          const unsigned from = integerValue(pop());
+          const unsigned to = integerValue(pop());
+          const Operand bv = pop();
+          push(emit(Opcode::Extract, Operand::BitVector, bv.reg, from, to));
+        } else if (realFn == "zero_extend") {
+          const unsigned width = integerValue(pop());
+          const Operand bv = pop();
+          push(emit(Opcode::ZExt, Operand::BitVector, bv.reg, width));
+        } else if (realFn == "sign_extend") {
+          const unsigned width = integerValue(pop());
+          const Operand bv = pop();
+          push(emit(Opcode::SExt, Operand::BitVector, bv.reg, width));
+        }
+        continue;
+      }
+
+      if (str == "and") {
+        compileBoolean(Opcode::BoolAnd);
+        continue;
+      }
+
+      if (str == "or") {
+        compileBoolean(Opcode::BoolOr);
+        continue;
+      }
+
+      // Let definition.
+      if (str.startswith("?")) {
+        letToVal[str] = pop();
+        continue;
+      }
+
+      if (str == "let")
+        continue;
+
+      if (str == "select") {
+        compileSelect();
+        continue;
+      }
+
+      if (str == "bvadd") {
+        compileBinaryBV(Opcode::BvAdd);
+        continue;
+      }
+
+      if (str == "bvmul") {
+        compileBinaryBV(Opcode::BvMul);
+        continue;
+      }
+
+      if (str == "bvand") {
+        compileBinaryBV(Opcode::BvAnd);
+        continue;
+      }
+
+      if (str == "bvor") {
+        compileBinaryBV(Opcode::BvOr);
+        continue;
+      }
+
+      if (str == "concat") {
+        compileBinaryBV(Opcode::Concat);
+        continue;
+      }
+
+      if (str == "bvult") {
+        compileCompare(Opcode::Ult);
+        continue;
+      }
+
+      if (str == "bvslt") {
+        compileCompare(Opcode::Slt);
+        continue;
+      }
+
+      if (str == "=") {
+        compileEq();
+        continue;
+      }
+
+      if (str == "assert") {
+        const Operand res = pop();
+        assert(res.kind == Operand::Bool);
+        m_code.push_back({Opcode::Assert, 0, res.reg, idx + 1, 0});
+        break;
+      }
+
+      llvm::errs() << "Head \"" << str << "\" not handled!\n";
+      llvm_unreachable("Symbol not handled");
+    }
+  }
+};
+
+const char *getOpcodeName(Opcode op) {
+  static const char *const names[] = {
+      "select",  "pselect8", "pselect16", "pselect32", "pselect64", "bvadd",
+      "bvmul",   "bvand",    "bvor",      "concat",    "eq",        "ult",
+      "slt",     "extract",  "zext",      "sext",      "and",       "or",
+      "booleq",  "assert",   "halt"};
+  static_assert(sizeof(names) / sizeof(names[0]) ==
+                    static_cast<size_t>(Opcode::NumOpcodes),
+                "Opcode names out of sync");
+  return names[static_cast<size_t>(op)];
+}
+} // namespace
+
+BytecodeProgram::BytecodeProgram(SmtLibParser &parser)
+    : m_numArrays(parser.numArrays()) {
+  m_numRegisters = BytecodeCompiler(parser, m_code, m_constants).compile();
+}
+
+void BytecodeProgram::dump(llvm::raw_ostream &os) const {
+  os << "constants: " << m_constants.size()
+     << ", registers: " << m_numRegisters << "\n";
+  for (size_t i = 0, e = m_code.size(); i != e; ++i) {
+    const Instruction &inst = m_code[i];
+    os << i << ":\t%" << inst.dst << " = " << getOpcodeName(inst.op) << " "
+       << inst.a << ", " << inst.b << ", " << inst.c << "\n";
+  }
+}
+
+BytecodeInterpreter::BytecodeInterpreter(const BytecodeProgram &program)
+    : m_program(program), m_registers(program.numRegisters()) {
+  for (size_t i = 0, e = program.m_constants.size(); i != e; ++i)
+    m_registers[i] = program.m_constants[i];
+}
+
+int BytecodeInterpreter::evaluate(bv_array **arrays) {
+  // Must be in the same order as Opcode.
+  static const void *const dispatchTable[] = {
+      &&Select, &&PackedSelect8, &&PackedSelect16, &&PackedSelect32,
+      &&PackedSelect64, &&BvAdd, &&BvMul, &&BvAnd, &&BvOr, &&Concat, &&Eq,
+      &&Ult, &&Slt, &&Extract, &&ZExt, &&SExt, &&BoolAnd, &&BoolOr, &&BoolEq,
+      &&Assert, &&Halt};
+  static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) ==
+                    static_cast<size_t>(Opcode::NumOpcodes),
+                "Dispatch table out of sync");
+
+  bitvector *regs = m_registers.data();
+  const Instruction *ip = m_program.m_code.data();
+
+#define DISPATCH() goto *dispatchTable[static_cast<size_t>(ip->op)]
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++ip;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+#define PACKED(a) reinterpret_cast<bv_packed_array *>(arrays[a])
+
+  DISPATCH();
+
+Select:
+  regs[ip->dst] = bva_select(arrays[ip->a], regs[ip->b]);
+  NEXT();
+PackedSelect8:
+  regs[ip->dst] = bvpa_select8(PACKED(ip->a), ip->c, regs[ip->b]);
+  NEXT();
+PackedSelect16:
+  regs[ip->dst] = bvpa_select16(PACKED(ip->a), ip->c, regs[ip->b]);
+  NEXT();
+PackedSelect32:
+  regs[ip->dst] = bvpa_select32(PACKED(ip->a), ip->c, regs[ip->b]);
+  NEXT();
+PackedSelect64:
+  regs[ip->dst] = bvpa_select64(PACKED(ip->a), ip->c, regs[ip->b]);
+  NEXT();
+BvAdd:
+  regs[ip->dst] = bv_add(regs[ip->a], regs[ip->b]);
+  NEXT();
+BvMul:
+  regs[ip->dst] = bv_mul(regs[ip->a], regs[ip->b]);
+  NEXT();
+BvAnd:
+  regs[ip->dst] = bv_and(regs[ip->a], regs[ip->b]);
+  NEXT();
+BvOr:
+  regs[ip->dst] = bv_or(regs[ip->a], regs[ip->b]);
+  NEXT();
+Concat:
+  regs[ip->dst] = bv_concat(regs[ip->a], regs[ip->b]);
+  NEXT();
+Eq:
+  regs[ip->dst].bits.data = bv_eq(regs[ip->a], regs[ip->b]);
+  NEXT();
+Ult:
+  regs[ip->dst].bits.data = bv_ult(regs[ip->a], regs[ip->b]);
+  NEXT();
+Slt:
+  regs[ip->dst].bits.data = bv_slt(regs[ip->a], regs[ip->b]);
+  NEXT();
+Extract:
+  regs[ip->dst] = bv_extract(regs[ip->a], ip->b, ip->c);
+  NEXT();
+ZExt:
+  regs[ip->dst] = bv_zext(regs[ip->a], ip->b);
+  NEXT();
+SExt:
+  regs[ip->dst] = bv_sext(regs[ip->a], ip->b);
+  NEXT();
+BoolAnd:
+  regs[ip->dst].bits.data = regs[ip->a].bits.data & regs[ip->b].bits.data;
+  NEXT();
+BoolOr:
+  regs[ip->dst].bits.data = regs[ip->a].bits.data | regs[ip->b].bits.data;
+  NEXT();
+BoolEq:
+  regs[ip->dst].bits.data = regs[ip->a].bits.data == regs[ip->b].bits.data;
+  NEXT();
+Assert:
+  if (regs[ip->a].bits.data == 0)
+    return ip->b;
+  NEXT();
+Halt:
+  return 0;
+
+#undef PACKED
+#undef NEXT
+#undef DISPATCH
+}
+
+void BytecodeInterpreter::evaluateBatch(bv_array ***assignments, size_t n,
+                                        int *results) {
+  for (size_t i = 0; i != n; ++i)
+    results[i] = evaluate(assignments[i]);
+}
+
+void BytecodeInterpreter::evaluate(AssignmentTable &table,
+                                   llvm::MutableArrayRef<int> results) {
+  assert(results.size() == table.size());
+  evaluateBatch(table.packs(), table.size(), results.data());
+}
+
+} // namespace smt_jit
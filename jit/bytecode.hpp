@@ -0,0 +1,102 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "bvlib/bvlib.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace smt_jit {
+class AssignmentTable;
+class SmtLibParser;
+
+enum class Opcode : unsigned char {
+  // dst = bva_select(arrays[a], b)
+  Select,
+  // dst = bvpa_select{8,16,32,64}(arrays[a], c, b), c is the element width.
+  PackedSelect8,
+  PackedSelect16,
+  PackedSelect32,
+  PackedSelect64,
+  // dst = bv_op(a, b)
+  BvAdd,
+  BvMul,
+  BvAnd,
+  BvOr,
+  Concat,
+  // dst = bv_cmp(a, b), a boolean
+  Eq,
+  Ult,
+  Slt,
+  // dst = bv_extract(a, b, c), b and c are immediates.
+  Extract,
+  // dst = bv_{z,s}ext(a, b), b is an immediate.
+  ZExt,
+  SExt,
+  // dst = a op b, on booleans
+  BoolAnd,
+  BoolOr,
+  BoolEq,
+  // Returns b (the 1-based assertion index) if a is false.
+  Assert,
+  // Returns 0.
+  Halt,
+  NumOpcodes
+};
+
+struct Instruction {
+  Opcode op;
+  unsigned dst;
+  unsigned a;
+  unsigned b;
+  unsigned c;
+};
+
+// Register-based bytecode of a formula, compiled from the same post-order walk
+// over the assertions as Smt2LLVM. Every instruction writes a fresh register.
+// Registers hold bitvectors or booleans. The constants live in the first
+// registers and are never overwritten.
+// Integer operands (widths, extract bounds) are folded into the instructions.
+class BytecodeProgram {
+  std::vector<Instruction> m_code;
+  // Initial values of the first registers.
+  std::vector<bitvector> m_constants;
+  unsigned m_numRegisters = 0;
+  size_t m_numArrays = 0;
+
+  friend class BytecodeInterpreter;
+
+public:
+  explicit BytecodeProgram(SmtLibParser &parser);
+
+  size_t size() const { return m_code.size(); }
+  unsigned numRegisters() const { return m_numRegisters; }
+  size_t numArrays() const { return m_numArrays; }
+
+  void dump(llvm::raw_ostream &os = llvm::errs()) const;
+};
+
+// Evaluates a BytecodeProgram with threaded (computed goto) dispatch, calling
+// the bvlib primitives directly. Needs no compilation, which makes it suitable
+// for one-shot queries and as a baseline for the jit. The register file is
+// owned by the interpreter, so every thread needs its own interpreter.
+class BytecodeInterpreter {
+  const BytecodeProgram &m_program;
+  // Booleans are stored in the bits of their registers.
+  std::vector<bitvector> m_registers;
+
+public:
+  explicit BytecodeInterpreter(const BytecodeProgram &program);
+
+  // Same as smt_N: returns 0 if the arrays model the formula, or the 1-based
+  // index of the first failing assertion.
+  int evaluate(bv_array **arrays);
+  // Same as smt_N_batch.
+  void evaluateBatch(bv_array ***assignments, size_t n, int *results);
+  // Evaluates all the packs of the table, like DeltaEvaluator::evaluate.
+  void evaluate(AssignmentTable &table, llvm::MutableArrayRef<int> results);
+};
+
+} // namespace smt_jit
@@ -0,0 +1,96 @@
+#include "doctest.h"
+
+#include "assignment_table.hpp"
+#include "bytecode.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+
+static std::vector<int> interpret(SmtLibParser &parser) {
+  BytecodeProgram program(parser);
+  BytecodeInterpreter interpreter(program);
+
+  bv_context *ctx = bv_context_create();
+  std::vector<int> results;
+  {
+    AssignmentTable table(parser, ctx);
+    results.resize(table.size());
+    interpreter.evaluateBatch(table.packs(), table.size(), results.data());
+  }
+  bv_context_destroy(ctx);
+  return results;
+}
+
+TEST_CASE("Test bytecode_first_failing_assertion") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    (assert (bvult  (select  a (_ bv1 32) ) (_ bv5 8) ) )
+    ; Assignments
+    ; { "a": [1, 2] }
+    ; { "a": [1, 9] }
+    ; { "a": [0, 0] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  CHECK(parser.numAssertions() == 2);
+
+  BytecodeProgram program(parser);
+  CHECK(program.numArrays() == 1);
+  // Two selects, two comparisons, two asserts, and halt.
+  CHECK(program.size() == 7);
+  program.dump();
+
+  CHECK(interpret(parser) == std::vector<int>{0, 2, 1});
+}
+
+TEST_CASE("Test bytecode_let_concat") {
+  std::string txt = R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv513 16) (concat  (select  n (_ bv1 32) ) (select  n (_ bv0 32) ) ) ) )
+    (assert (let ( (?B1 (select  n (_ bv2 32) ) ) ) (and  (bvult  (_ bv3 8) ?B1 ) (=  false (=  (_ bv7 8) ?B1 ) ) ) ) )
+    ; Assignments
+    ; { "n": [2, 1, 4] }
+    ; { "n": [2, 1, 7] }
+    ; { "n": [2, 1, 2] }
+    ; { "n": [1, 2, 4] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  CHECK(parser.numAssertions() == 2);
+  CHECK(interpret(parser) == std::vector<int>{0, 2, 2, 1});
+}
+
+TEST_CASE("Test bytecode_arithmetic") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (or  (=  (_ bv10 8) (bvadd  (select  a (_ bv0 32) ) (select  a (_ bv1 32) ) ) ) (=  (_ bv12 8) (bvmul  (select  a (_ bv0 32) ) (select  a (_ bv1 32) ) ) ) ) )
+    ; Assignments
+    ; { "a": [4, 6] }
+    ; { "a": [3, 4] }
+    ; { "a": [1, 1] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  CHECK(interpret(parser) == std::vector<int>{0, 0, 1});
+}
+
+TEST_CASE("Test bytecode_wide_elements") {
+  std::string txt = R"(
+    (declare-fun w () (Array (_ BitVec 32) (_ BitVec 72) ) )
+    (assert (=  (_ bv5 72) (select  w (_ bv1 32) ) ) )
+    ; Assignments
+    ; { "w": [1, 5] }
+    ; { "w": [5, 1] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  CHECK(interpret(parser) == std::vector<int>{0, 1});
+}
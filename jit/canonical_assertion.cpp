@@ -0,0 +1,116 @@
+#include "canonical_assertion.hpp"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "formula_cache.hpp"
+
+#include <algorithm>
+
+namespace smt_jit {
+
+namespace {
+class Canonicalizer {
+  const llvm::StringMap<unsigned> &m_declIdxs;
+  // Declaration index to canonical array index.
+  llvm::DenseMap<unsigned, unsigned> m_arrayIdxs;
+  llvm::StringMap<unsigned> m_letIdxs;
+  // Lifted literals, when enabled.
+  std::vector<uint64_t> *m_constants;
+
+public:
+  Canonicalizer(const llvm::StringMap<unsigned> &declIdxs,
+                std::vector<uint64_t> *constants)
+      : m_declIdxs(declIdxs), m_constants(constants) {}
+
+  void collectArrays(sexpresso::Sexp &sexp,
+                     llvm::SmallVectorImpl<unsigned> &arrays) {
+    if (sexp.isString()) {
+      auto it = m_declIdxs.find(sexp.getString());
+      if (it != m_declIdxs.end() &&
+          std::find(arrays.begin(), arrays.end(), it->second) == arrays.end())
+        arrays.push_back(it->second);
+      return;
+    }
+
+    for (size_t i = 0, e = sexp.childCount(); i != e; ++i)
+      collectArrays(sexp.getChild(i), arrays);
+  }
+
+  void setArrays(llvm::ArrayRef<unsigned> arrays) {
+    for (size_t i = 0, e = arrays.size(); i != e; ++i)
+      m_arrayIdxs[arrays[i]] = i;
+  }
+
+  void print(sexpresso::Sexp &sexp, llvm::raw_ostream &os) {
+    if (sexp.isString()) {
+      const std::string &str = sexp.getString();
+      auto arrIt = m_declIdxs.find(str);
+      if (arrIt != m_declIdxs.end()) {
+        os << "a" << m_arrayIdxs[arrIt->second];
+        return;
+      }
+
+      if (!str.empty() && str[0] == '?') {
+        // Lets are printed in pre-order, so the binding comes first.
+        auto letIt = m_letIdxs.insert({str, m_letIdxs.size()}).first;
+        os << "?L" << letIt->second;
+        return;
+      }
+
+      os << str;
+      return;
+    }
+
+    // Bitvector literals: (_ bvN width).
+    if (m_constants && sexp.childCount() == 3 && sexp.getChild(0).isString() &&
+        sexp.getChild(0).getString() == "_" && sexp.getChild(1).isString()) {
+      llvm::StringRef fn = sexp.getChild(1).getString();
+      uint64_t value = 0;
+      if (fn.startswith("bv") && !fn.substr(2).getAsInteger(10, value)) {
+        m_constants->push_back(value);
+        os << "(_ bv? ";
+        print(sexp.getChild(2), os);
+        os << ")";
+        return;
+      }
+    }
+
+    os << "(";
+    for (size_t i = 0, e = sexp.childCount(); i != e; ++i) {
+      if (i != 0)
+        os << " ";
+      print(sexp.getChild(i), os);
+    }
+    os << ")";
+  }
+};
+} // namespace
+
+CanonicalAssertion canonicalizeAssertion(sexpresso::Sexp &assertion,
+                                         llvm::ArrayRef<ArrayInfo> arrays,
+                                         bool liftConstants) {
+  llvm::StringMap<unsigned> declIdxs;
+  for (size_t a = 0, e = arrays.size(); a != e; ++a)
+    declIdxs[arrays[a].name] = a;
+
+  CanonicalAssertion canonical;
+  Canonicalizer canonicalizer(declIdxs,
+                              liftConstants ? &canonical.constants : nullptr);
+  canonicalizer.collectArrays(assertion, canonical.arrays);
+  std::sort(canonical.arrays.begin(), canonical.arrays.end());
+  canonicalizer.setArrays(canonical.arrays);
+
+  llvm::raw_string_ostream os(canonical.text);
+  for (unsigned a : canonical.arrays)
+    os << "(array " << arrays[a].element_width << " " << arrays[a].is_bitvector
+       << ") ";
+  canonicalizer.print(assertion, os);
+  os.flush();
+
+  canonical.hash = hashString(canonical.text);
+  return canonical;
+}
+
+} // namespace smt_jit
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "smtlib_parser.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace smt_jit {
+
+// Assertion in a form that does not depend on the names chosen by the query:
+// let names are renamed to ?L0, ?L1, ... in the binding order, and the arrays
+// read by the assertion to a0, a1, ..., in the declaration order. Assertions
+// with equal canonical forms can share compiled code.
+//
+// With constant lifting, the values of the bitvector literals are replaced
+// with placeholders as well, so that the canonical form only describes the
+// shape of the assertion.
+struct CanonicalAssertion {
+  // Types of the read arrays followed by the renamed, whitespace-normalized
+  // assertion.
+  std::string text;
+  // Indices (as in SmtLibParser::arrays) of the arrays read by the assertion,
+  // in the declaration order, i.e., the arrays a0, a1, ... stand for.
+  llvm::SmallVector<unsigned, 4> arrays;
+  // Values of the lifted literals, in the order they appear in the assertion.
+  // Empty without constant lifting.
+  std::vector<uint64_t> constants;
+  // Hex SHA1 of the text.
+  std::string hash;
+};
+
+CanonicalAssertion canonicalizeAssertion(sexpresso::Sexp &assertion,
+                                         llvm::ArrayRef<ArrayInfo> arrays,
+                                         bool liftConstants = false);
+
+} // namespace smt_jit
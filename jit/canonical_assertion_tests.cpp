@@ -0,0 +1,94 @@
+#include "doctest.h"
+
+#include "canonical_assertion.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+
+static std::vector<CanonicalAssertion> canonicalize(const std::string &txt) {
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  std::vector<CanonicalAssertion> res;
+  for (sexpresso::Sexp &assertion : parser.assertions())
+    res.push_back(canonicalizeAssertion(assertion, parser.arrays()));
+  return res;
+}
+
+TEST_CASE("Test canonical_assertion_renaming") {
+  const std::vector<CanonicalAssertion> first = canonicalize(R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (let ( (?B1 (select  b (_ bv0 32) ) ) ) (bvult  ?B1 (_ bv4 8) ) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv2 32) ) ) )
+  )");
+  const std::vector<CanonicalAssertion> second = canonicalize(R"(
+    (declare-fun x () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (let ( (?B7 (select  x (_ bv0 32) ) ) ) (bvult  ?B7 (_ bv4 8) ) ) )
+    (assert (=  (_ bv1 8) (select  x (_ bv3 32) ) ) )
+  )");
+  REQUIRE(first.size() == 2);
+  REQUIRE(second.size() == 2);
+
+  // Array and let names do not matter.
+  CHECK(first[0].hash.size() == 40);
+  CHECK(first[0].text == second[0].text);
+  CHECK(first[0].hash == second[0].hash);
+  CHECK(first[0].arrays.size() == 1);
+  CHECK(first[0].arrays[0] == 1);
+  CHECK(second[0].arrays[0] == 0);
+
+  // Constants do.
+  CHECK(first[1].hash != second[1].hash);
+}
+
+TEST_CASE("Test canonical_assertion_array_order") {
+  const std::vector<CanonicalAssertion> canonical = canonicalize(R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun c () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvult  (select  c (_ bv0 32) ) (select  a (_ bv0 32) ) ) )
+    (assert (bvult  (select  a (_ bv0 32) ) (select  c (_ bv0 32) ) ) )
+  )");
+  REQUIRE(canonical.size() == 2);
+
+  // Arrays are numbered in the declaration order, not in the order of reads.
+  for (const CanonicalAssertion &assertion : canonical) {
+    REQUIRE(assertion.arrays.size() == 2);
+    CHECK(assertion.arrays[0] == 0);
+    CHECK(assertion.arrays[1] == 2);
+  }
+  CHECK(canonical[0].hash != canonical[1].hash);
+}
+
+TEST_CASE("Test canonical_assertion_lifted_constants") {
+  const std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv61 8) (select  a (_ bv0 32) ) ) )
+    (assert (=  (_ bv112 8) (select  a (_ bv1 32) ) ) )
+    (assert (=  (_ bv112 16) (concat  (select  a (_ bv1 32) ) (select  a (_ bv0 32) ) ) ) )
+  )";
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  std::vector<CanonicalAssertion> lifted;
+  for (sexpresso::Sexp &assertion : parser.assertions())
+    lifted.push_back(canonicalizeAssertion(assertion, parser.arrays(),
+                                           /* liftConstants = */ true));
+  REQUIRE(lifted.size() == 3);
+
+  // The literal values are in the table, in the order they appear in.
+  CHECK(lifted[0].hash == lifted[1].hash);
+  CHECK(lifted[0].constants == std::vector<uint64_t>{61, 0});
+  CHECK(lifted[1].constants == std::vector<uint64_t>{112, 1});
+  CHECK(lifted[2].constants == std::vector<uint64_t>{112, 1, 0});
+
+  // Literal widths are a part of the shape.
+  CHECK(lifted[0].hash != lifted[2].hash);
+
+  const CanonicalAssertion plain =
+      canonicalizeAssertion(parser.assertions()[0], parser.arrays());
+  CHECK(plain.constants.empty());
+  CHECK(plain.hash != lifted[0].hash);
+}
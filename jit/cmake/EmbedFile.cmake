@@ -0,0 +1,8 @@
+# Writes the contents of the INPUT file to OUTPUT as a list of comma separated
+# byte literals, to be #included in an array initializer.
+#
+# Usage: cmake -DINPUT=<file> -DOUTPUT=<file> -P EmbedFile.cmake
+
+file(READ ${INPUT} CONTENTS HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," CONTENTS "${CONTENTS}")
+file(WRITE ${OUTPUT} "${CONTENTS}\n")
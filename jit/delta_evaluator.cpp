@@ -0,0 +1,71 @@
+#include "delta_evaluator.hpp"
+
+#include "assignment_table.hpp"
+#include "read_set.hpp"
+#include "smtlib_parser.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace smt_jit {
+
+DeltaEvaluator::DeltaEvaluator(SmtLibParser &parser,
+                               const AssignmentTable &table,
+                               std::vector<SmtAssertionFunctionTy> assertionFns)
+    : m_table(table), m_assertionFns(std::move(assertionFns)),
+      m_cached(m_assertionFns.size(), 0),
+      m_valid(m_assertionFns.size(), false) {
+  const size_t numAssertions = parser.numAssertions();
+  assert(m_assertionFns.size() == numAssertions);
+
+  const std::vector<ReadSet> readSets = computeReadSets(parser);
+
+  const size_t numPacks = table.size();
+  m_dirty.assign(numPacks * numAssertions, true);
+
+  for (size_t p = 1; p < numPacks; ++p) {
+    const Assignment &prev =
+        parser.assignments()[table.getAssignmentIdx(p - 1)];
+    const Assignment &curr = parser.assignments()[table.getAssignmentIdx(p)];
+
+    for (size_t k = 0; k != numAssertions; ++k)
+      m_dirty[p * numAssertions + k] =
+          readSets[k].differs(parser.arrays(), prev, curr);
+  }
+}
+
+void DeltaEvaluator::evaluate(llvm::MutableArrayRef<int> results) {
+  const size_t numAssertions = m_assertionFns.size();
+  assert(results.size() == m_table.size());
+
+  // Every evaluation starts from scratch, so that the results do not depend
+  // on the previous calls.
+  std::fill(m_valid.begin(), m_valid.end(), false);
+
+  llvm::ArrayRef<bv_array **> packs = m_table.packs();
+  for (size_t p = 0, e = packs.size(); p != e; ++p) {
+    for (size_t k = 0; k != numAssertions; ++k)
+      if (m_dirty[p * numAssertions + k])
+        m_valid[k] = false;
+
+    int res = 0;
+    for (size_t k = 0; k != numAssertions; ++k) {
+      if (m_valid[k]) {
+        ++m_numReused;
+      } else {
+        m_cached[k] = m_assertionFns[k](packs[p]);
+        m_valid[k] = true;
+        ++m_numEvaluated;
+      }
+
+      if (m_cached[k] == 0) {
+        res = k + 1;
+        break;
+      }
+    }
+
+    results[p] = res;
+  }
+}
+
+} // namespace smt_jit
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include "bvlib/bvlib.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace smt_jit {
+class AssignmentTable;
+class SmtLibParser;
+
+// int smt_N_check_K(bv_array **arrays)
+using SmtAssertionFunctionTy = int (*)(bv_array **);
+
+// Evaluates a formula assertion by assertion over the packs of an
+// AssignmentTable, in order, reusing the result of an assertion from the
+// previous packs as long as the assignments only differ at array indices the
+// assertion does not read. KLEE's assignments of a single query are often
+// identical except for a few bytes, so most assertions are not re-evaluated.
+//
+// Which assertions have to be re-evaluated for every pack is computed once, so
+// repeated evaluations of the same table only pay for the changed assertions.
+class DeltaEvaluator {
+  const AssignmentTable &m_table;
+  std::vector<SmtAssertionFunctionTy> m_assertionFns;
+  // Set if an assertion may evaluate differently on a pack than on the
+  // previous one; indexed by pack * numAssertions + assertion.
+  std::vector<bool> m_dirty;
+
+  std::vector<int> m_cached;
+  std::vector<bool> m_valid;
+  size_t m_numEvaluated = 0;
+  size_t m_numReused = 0;
+
+public:
+  DeltaEvaluator(SmtLibParser &parser, const AssignmentTable &table,
+                 std::vector<SmtAssertionFunctionTy> assertionFns);
+
+  // Same results as smt_N_batch over all the packs of the table.
+  void evaluate(llvm::MutableArrayRef<int> results);
+
+  // Assertion evaluations performed and skipped, over all evaluate calls.
+  size_t numEvaluated() const { return m_numEvaluated; }
+  size_t numReused() const { return m_numReused; }
+};
+
+} // namespace smt_jit
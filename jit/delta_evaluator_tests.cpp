@@ -0,0 +1,92 @@
+#include "doctest.h"
+
+#include "assertion_test_utils.hpp"
+#include "assignment_table.hpp"
+#include "delta_evaluator.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+using namespace smt_jit::test;
+
+// (bvult (select a (_ bv1 32)) (_ bv5 8))
+static int checkSecond(bv_array **arrays) {
+  ++numAssertionChecks();
+  return selectByte(arrays, 1) < 5;
+}
+
+// (bvult (select a (select a (_ bv2 32))) (_ bv5 8))
+static int checkSymbolic(bv_array **arrays) {
+  ++numAssertionChecks();
+  return selectByte(arrays, selectByte(arrays, 2)) < 5;
+}
+
+static std::vector<int> evaluate(SmtLibParser &parser,
+                                 std::vector<SmtAssertionFunctionTy> fns,
+                                 size_t &numReused) {
+  bv_context *ctx = bv_context_create();
+  std::vector<int> results;
+  {
+    AssignmentTable table(parser, ctx);
+    DeltaEvaluator evaluator(parser, table, std::move(fns));
+    results.resize(table.size());
+    evaluator.evaluate(results);
+    CHECK(evaluator.numEvaluated() == numAssertionChecks());
+    numReused = evaluator.numReused();
+  }
+  bv_context_destroy(ctx);
+  return results;
+}
+
+TEST_CASE("Test delta_constant_indices") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    (assert (bvult  (select  a (_ bv1 32) ) (_ bv5 8) ) )
+    ; Assignments
+    ; { "a": [1, 2, 0] }
+    ; { "a": [1, 3, 0] }
+    ; { "a": [1, 3, 7] }
+    ; { "a": [1, 9, 7] }
+    ; { "a": [0, 9, 7] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  numAssertionChecks() = 0;
+  size_t numReused = 0;
+  CHECK(evaluate(parser, {checkFirst, checkSecond}, numReused) ==
+        std::vector<int>{0, 0, 0, 2, 1});
+  // The first assertion is only re-evaluated for the last assignment, the
+  // second one is not needed there. The third assignment only changes an
+  // index neither of them reads.
+  CHECK(numAssertionChecks() == 5);
+  CHECK(numReused == 4);
+}
+
+TEST_CASE("Test delta_symbolic_index") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    (assert (bvult  (select  a (select  a (_ bv2 32) ) ) (_ bv5 8) ) )
+    ; Assignments
+    ; { "a": [1, 2, 1, 9] }
+    ; { "a": [1, 2, 3, 9] }
+    ; { "a": [1, 2, 3, 4] }
+    ; { "a": [1, 2, 3, 4, 8] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  numAssertionChecks() = 0;
+  size_t numReused = 0;
+  CHECK(evaluate(parser, {checkFirst, checkSymbolic}, numReused) ==
+        std::vector<int>{0, 2, 0, 0});
+  // Any change to the array invalidates the symbolic read.
+  CHECK(numAssertionChecks() == 5);
+  CHECK(numReused == 3);
+}
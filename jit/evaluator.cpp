@@ -0,0 +1,132 @@
+#include "evaluator.hpp"
+
+#include "assignment_table.hpp"
+
+#include "llvm/ADT/STLExtras.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace smt_jit {
+
+llvm::Optional<size_t> findFirstModel(const AssignmentTable &table,
+                                      SmtFirstFunctionTy smtFirstFunctionPtr) {
+  assert(smtFirstFunctionPtr);
+  const size_t numPacks = table.size();
+  const size_t first = smtFirstFunctionPtr(
+      const_cast<bv_array ***>(table.packs().data()), numPacks);
+  assert(first <= numPacks);
+
+  if (first == numPacks)
+    return llvm::None;
+
+  return table.getAssignmentIdx(first);
+}
+
+ParallelEvaluator::ParallelEvaluator(SmtLibParser &parser, unsigned numThreads,
+                                     size_t chunkSize)
+    : m_chunkSize(std::max<size_t>(chunkSize, 1)) {
+  numThreads = std::max(numThreads, 1u);
+  m_tables.resize(numThreads);
+  m_numBusy = numThreads;
+  m_workers.reserve(numThreads);
+  for (unsigned i = 0; i != numThreads; ++i)
+    m_workers.emplace_back([this, &parser, i] { runWorker(parser, i); });
+
+  // Wait for all the tables, so that evaluate only evaluates.
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_workDone.wait(lock, [this] { return m_numBusy == 0; });
+}
+
+ParallelEvaluator::~ParallelEvaluator() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_exit = true;
+  }
+  m_workReady.notify_all();
+
+  for (std::thread &t : m_workers)
+    t.join();
+}
+
+size_t ParallelEvaluator::evaluate(SmtBatchFunctionTy smtBatchFunctionPtr,
+                                   unsigned iterations,
+                                   llvm::MutableArrayRef<int> results) {
+  assert(smtBatchFunctionPtr);
+
+  const size_t numPacks = getTable().size();
+  assert(results.empty() || results.size() == numPacks);
+
+  if (numPacks == 0 || iterations == 0)
+    return 0;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_smtBatchFunctionPtr = smtBatchFunctionPtr;
+  m_results = results;
+  m_chunksPerIteration = (numPacks + m_chunkSize - 1) / m_chunkSize;
+  m_numTasks = m_chunksPerIteration * iterations;
+  m_nextTask.store(0, std::memory_order_relaxed);
+  m_totalModels.store(0, std::memory_order_relaxed);
+
+  m_numBusy = m_workers.size();
+  ++m_generation;
+  m_workReady.notify_all();
+  m_workDone.wait(lock, [this] { return m_numBusy == 0; });
+
+  return m_totalModels.load();
+}
+
+void ParallelEvaluator::runWorker(SmtLibParser &parser, unsigned workerIdx) {
+  bv_context *ctx = bv_context_create();
+  m_tables[workerIdx] = llvm::make_unique<AssignmentTable>(parser, ctx);
+  AssignmentTable &table = *m_tables[workerIdx];
+
+  unsigned generation = 0;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    if (--m_numBusy == 0)
+      m_workDone.notify_one();
+
+    m_workReady.wait(lock,
+                     [&] { return m_exit || m_generation != generation; });
+    if (m_exit)
+      break;
+    generation = m_generation;
+
+    lock.unlock();
+    runTasks(table);
+    lock.lock();
+  }
+  lock.unlock();
+
+  m_tables[workerIdx].reset();
+  bv_context_destroy(ctx);
+}
+
+void ParallelEvaluator::runTasks(AssignmentTable &table) {
+  const size_t numPacks = table.size();
+  std::vector<int> chunkResults(m_chunkSize);
+  size_t numModels = 0;
+
+  for (size_t task = m_nextTask.fetch_add(1, std::memory_order_relaxed);
+       task < m_numTasks;
+       task = m_nextTask.fetch_add(1, std::memory_order_relaxed)) {
+    const size_t iteration = task / m_chunksPerIteration;
+    const size_t begin = (task % m_chunksPerIteration) * m_chunkSize;
+    const size_t n = std::min(m_chunkSize, numPacks - begin);
+
+    m_smtBatchFunctionPtr(table.packs() + begin, n, chunkResults.data());
+    numModels +=
+        std::count(chunkResults.begin(), chunkResults.begin() + n, 0);
+
+    // Results are the same in every iteration; only the first one writes
+    // them out.
+    if (iteration == 0 && !m_results.empty())
+      std::copy(chunkResults.begin(), chunkResults.begin() + n,
+                m_results.begin() + begin);
+  }
+
+  m_totalModels.fetch_add(numModels, std::memory_order_relaxed);
+}
+
+} // namespace smt_jit
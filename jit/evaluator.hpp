@@ -0,0 +1,89 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+
+#include "bvlib/bvlib.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace smt_jit {
+class AssignmentTable;
+class SmtLibParser;
+
+// void smt_N_batch(bv_array ***assignments, size_t n, int *results)
+using SmtBatchFunctionTy = void (*)(bv_array ***, size_t, int *);
+// size_t smt_N_first(bv_array ***assignments, size_t n)
+using SmtFirstFunctionTy = size_t (*)(bv_array ***, size_t);
+
+// Returns the index (in the parser's assignment order) of the first assignment
+// of the table that models the formula, or None if there is no model. The
+// jitted function stops at the first model, so cache hits early in the table
+// are cheap.
+llvm::Optional<size_t> findFirstModel(const AssignmentTable &table,
+                                      SmtFirstFunctionTy smtFirstFunctionPtr);
+
+// Evaluates a jitted formula over the assignments of a single query on
+// multiple threads. The iteration space (iterations x assignments) is split
+// into chunks of assignments that idle workers claim dynamically.
+//
+// The workers are started by the constructor. Every worker creates its own
+// bvlib context (arena) and marshals its own copy of the assignment table in
+// it, so that the workers never share any bvlib memory and the arrays stay
+// local to the core that evaluates them. The workers and their tables are
+// reused by every evaluate call, until the evaluator is destroyed.
+class ParallelEvaluator {
+  size_t m_chunkSize;
+  std::vector<std::thread> m_workers;
+  // Table of each worker, created and destroyed by the worker itself.
+  std::vector<std::unique_ptr<AssignmentTable>> m_tables;
+
+  std::mutex m_mutex;
+  std::condition_variable m_workReady;
+  std::condition_variable m_workDone;
+  // Incremented by every evaluate call; each worker runs every generation
+  // once.
+  unsigned m_generation = 0;
+  // Workers that have not finished their tables or the current generation.
+  unsigned m_numBusy = 0;
+  bool m_exit = false;
+
+  // The current evaluation.
+  SmtBatchFunctionTy m_smtBatchFunctionPtr = nullptr;
+  llvm::MutableArrayRef<int> m_results;
+  size_t m_chunksPerIteration = 0;
+  size_t m_numTasks = 0;
+  std::atomic<size_t> m_nextTask{0};
+  std::atomic<size_t> m_totalModels{0};
+
+public:
+  ParallelEvaluator(SmtLibParser &parser, unsigned numThreads,
+                    size_t chunkSize = 64);
+  ~ParallelEvaluator();
+
+  ParallelEvaluator(const ParallelEvaluator &) = delete;
+  ParallelEvaluator &operator=(const ParallelEvaluator &) = delete;
+
+  // The table of the first worker. All the workers marshal the same packs,
+  // so it can stand in for the table of the query, e.g., to map the results
+  // back to the assignments. Only valid between evaluate calls.
+  AssignmentTable &getTable() { return *m_tables.front(); }
+
+  // Evaluates all the full assignments `iterations` times and returns the
+  // total number of models found. If `results` is not empty, it receives the
+  // result of every assignment pack, in the AssignmentTable order.
+  size_t evaluate(SmtBatchFunctionTy smtBatchFunctionPtr, unsigned iterations,
+                  llvm::MutableArrayRef<int> results = {});
+
+private:
+  void runWorker(SmtLibParser &parser, unsigned workerIdx);
+  void runTasks(AssignmentTable &table);
+};
+
+} // namespace smt_jit
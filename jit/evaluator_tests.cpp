@@ -0,0 +1,46 @@
+#include "doctest.h"
+
+#include "assertion_test_utils.hpp"
+#include "assignment_table.hpp"
+#include "evaluator.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+using namespace smt_jit::test;
+
+// smt_N_batch of (= (_ bv1 8) (select a (_ bv0 32))).
+static void batchFirstIsOne(bv_array ***assignments, size_t n, int *results) {
+  for (size_t i = 0; i != n; ++i)
+    results[i] = selectByte(assignments[i], 0) == 1 ? 0 : 1;
+}
+
+TEST_CASE("Test evaluator_parallel") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    ; Assignments
+    ; { "a": [1] }
+    ; { "a": [2] }
+    ; { "a": [1] }
+    ; { "a": [3] }
+    ; { "a": [1] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  ParallelEvaluator evaluator(parser, /* numThreads = */ 3,
+                              /* chunkSize = */ 2);
+  REQUIRE(evaluator.getTable().size() == 5);
+
+  std::vector<int> results(5);
+  CHECK(evaluator.evaluate(batchFirstIsOne, 1, results) == 3);
+  CHECK(results == std::vector<int>{0, 1, 0, 1, 0});
+
+  // The workers and their tables are reused.
+  CHECK(evaluator.evaluate(batchFirstIsOne, 4) == 12);
+  CHECK(evaluator.evaluate(batchFirstIsOne, 0) == 0);
+}
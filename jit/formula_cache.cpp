@@ -0,0 +1,119 @@
+#include "formula_cache.hpp"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "smtlib_parser.hpp"
+#include "smtlib_to_llvm.hpp"
+
+namespace smt_jit {
+
+std::string hashString(llvm::StringRef data) {
+  llvm::SHA1 hasher;
+  hasher.update(data);
+  return llvm::toHex(hasher.final(), /* LowerCase = */ true);
+}
+
+std::string hashFormula(SmtLibParser &parser, const FormulaEmitOptions &options,
+                        llvm::StringRef environment) {
+  std::string normalized;
+  llvm::raw_string_ostream os(normalized);
+
+  os << environment << "\n";
+  for (const ArrayInfo &ai : parser.arrays())
+    os << "array " << ai.name << " " << ai.element_width << " "
+       << ai.is_bitvector << "\n";
+  for (const sexpresso::Sexp &assertion : parser.assertions())
+    os << assertion.toString() << "\n";
+
+  os << "lanes " << options.lanes << " first " << options.first << " dual "
+     << options.dual << " entry-points " << options.assertionEntryPoints
+     << " shared " << options.shareAssertions << " lifted "
+     << options.liftConstants << " order";
+  for (unsigned i : options.assertionOrder)
+    os << " " << i;
+
+  return hashString(os.str());
+}
+
+std::string hashSharedAssertions(llvm::ArrayRef<std::string> names,
+                                 llvm::StringRef environment) {
+  std::string normalized;
+  llvm::raw_string_ostream os(normalized);
+
+  os << environment << "\n";
+  for (const std::string &name : names)
+    os << name << "\n";
+
+  return hashString(os.str());
+}
+
+FormulaObjectCache::FormulaObjectCache(std::string cacheDir)
+    : m_cacheDir(std::move(cacheDir)) {
+  if (std::error_code ec = llvm::sys::fs::create_directories(m_cacheDir))
+    llvm::errs() << "Could not create the object cache directory "
+                 << m_cacheDir << ": " << ec.message() << "\n";
+}
+
+bool FormulaObjectCache::isCacheable(const llvm::Module &M) {
+  return llvm::StringRef(M.getModuleIdentifier()).startswith("smt_");
+}
+
+std::string FormulaObjectCache::getObjectPath(llvm::StringRef moduleId) const {
+  llvm::SmallString<128> path(m_cacheDir);
+  llvm::sys::path::append(path, moduleId + ".o");
+  return path.str().str();
+}
+
+void FormulaObjectCache::notifyObjectCompiled(const llvm::Module *M,
+                                              llvm::MemoryBufferRef obj) {
+  if (!isCacheable(*M))
+    return;
+
+  // Write to a temporary file first, so that concurrent runs never see
+  // partially written objects.
+  const std::string path = getObjectPath(M->getModuleIdentifier());
+  llvm::SmallString<128> tempPath;
+  int fd = -1;
+  if (std::error_code ec = llvm::sys::fs::createUniqueFile(
+          path + "-%%%%%%.tmp", fd, tempPath)) {
+    llvm::errs() << "Could not write to the object cache: " << path << ": "
+                 << ec.message() << "\n";
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream os(fd, /* shouldClose = */ true);
+    os << obj.getBuffer();
+  }
+
+  if (std::error_code ec = llvm::sys::fs::rename(tempPath, path))
+    llvm::errs() << "Could not write to the object cache: " << path << ": "
+                 << ec.message() << "\n";
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+FormulaObjectCache::getObject(const llvm::Module *M) {
+  if (!isCacheable(*M))
+    return nullptr;
+
+  auto errBuffer =
+      llvm::MemoryBuffer::getFile(getObjectPath(M->getModuleIdentifier()));
+  if (!errBuffer) {
+    ++m_numMisses;
+    return nullptr;
+  }
+
+  ++m_numHits;
+  return std::move(*errBuffer);
+}
+
+bool FormulaObjectCache::hasObject(const llvm::Module &M) const {
+  return isCacheable(M) &&
+         llvm::sys::fs::exists(getObjectPath(M.getModuleIdentifier()));
+}
+
+} // namespace smt_jit
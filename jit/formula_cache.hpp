@@ -0,0 +1,62 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace smt_jit {
+class SmtLibParser;
+struct FormulaEmitOptions;
+
+// Lowercase hex SHA1 of the data.
+std::string hashString(llvm::StringRef data);
+
+// Hash of the formula (its arrays and whitespace-normalized assertions), as
+// emitted with the given options, salted with the environment it is compiled
+// in (e.g., the bvlib version, target, and optimization flags). Formulas with
+// equal hashes compile to the same object code.
+std::string hashFormula(SmtLibParser &parser, const FormulaEmitOptions &options,
+                        llvm::StringRef environment);
+
+// Hash of a module of shared assertion functions (see emitSharedAssertions),
+// from their names, salted with the environment as in hashFormula. The names
+// already are hashes of the canonical assertions the functions evaluate.
+std::string hashSharedAssertions(llvm::ArrayRef<std::string> names,
+                                 llvm::StringRef environment);
+
+// Persistent object cache of the formula modules, storing every object file as
+// <cacheDir>/<module identifier>.o. Only modules with identifiers starting
+// with "smt_" are cached, so the identifiers (and the names of the entry
+// points) have to be content hashes, as from hashFormula and
+// hashSharedAssertions.
+class FormulaObjectCache : public llvm::ObjectCache {
+  std::string m_cacheDir;
+  // The formulas may be compiled concurrently.
+  std::atomic<unsigned> m_numHits{0};
+  std::atomic<unsigned> m_numMisses{0};
+
+  static bool isCacheable(const llvm::Module &M);
+  std::string getObjectPath(llvm::StringRef moduleId) const;
+
+public:
+  explicit FormulaObjectCache(std::string cacheDir);
+
+  void notifyObjectCompiled(const llvm::Module *M,
+                            llvm::MemoryBufferRef obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+
+  // Returns true if the module is already compiled; its IR does not have to
+  // be optimized then.
+  bool hasObject(const llvm::Module &M) const;
+
+  unsigned numHits() const { return m_numHits; }
+  unsigned numMisses() const { return m_numMisses; }
+};
+
+} // namespace smt_jit
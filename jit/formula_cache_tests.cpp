@@ -0,0 +1,88 @@
+#include "doctest.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+
+#include "formula_cache.hpp"
+#include "smtlib_parser.hpp"
+#include "smtlib_to_llvm.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace smt_jit;
+
+static std::string hashText(const std::string &txt,
+                            const FormulaEmitOptions &options = {},
+                            llvm::StringRef environment = "env") {
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  return hashFormula(parser, options, environment);
+}
+
+TEST_CASE("Test formula_hash") {
+  const std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+  )";
+  const std::string hash = hashText(txt);
+  CHECK(hash.size() == 40);
+
+  // Whitespace does not matter.
+  CHECK(hashText(R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (= (_ bv1 8)    (select a (_ bv0 32))))
+  )") == hash);
+
+  CHECK(hashText(R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv2 8) (select  a (_ bv0 32) ) ) )
+  )") != hash);
+
+  FormulaEmitOptions lanes;
+  lanes.lanes = 4;
+  CHECK(hashText(txt, lanes) != hash);
+  CHECK(hashText(txt, {}, "other env") != hash);
+}
+
+TEST_CASE("Test formula_shared_assertions_hash") {
+  const std::vector<std::string> names = {"smt_assert_01", "smt_assert_02"};
+  const std::string hash = hashSharedAssertions(names, "env");
+  CHECK(hash.size() == 40);
+  CHECK(hashSharedAssertions(names, "env") == hash);
+  CHECK(hashSharedAssertions({"smt_assert_01"}, "env") != hash);
+  CHECK(hashSharedAssertions(names, "other env") != hash);
+}
+
+TEST_CASE("Test formula_object_cache") {
+  llvm::SmallString<128> cacheDir;
+  REQUIRE(!llvm::sys::fs::createUniqueDirectory("smt-jit-cache", cacheDir));
+
+  llvm::LLVMContext ctx;
+  llvm::Module formula("smt_0123abcd", ctx);
+  llvm::Module other("bvlib.ll", ctx);
+
+  {
+    FormulaObjectCache cache(cacheDir.str().str());
+    CHECK(!cache.hasObject(formula));
+    CHECK(!cache.getObject(&formula));
+
+    cache.notifyObjectCompiled(&formula,
+                               llvm::MemoryBufferRef("object", "formula"));
+    cache.notifyObjectCompiled(&other, llvm::MemoryBufferRef("object", "bv"));
+    CHECK(!cache.hasObject(other));
+    CHECK(cache.numMisses() == 1);
+  }
+
+  // The objects persist across cache instances.
+  FormulaObjectCache cache(cacheDir.str().str());
+  CHECK(cache.hasObject(formula));
+  std::unique_ptr<llvm::MemoryBuffer> obj = cache.getObject(&formula);
+  REQUIRE(obj);
+  CHECK(obj->getBuffer() == "object");
+  CHECK(cache.numHits() == 1);
+
+  llvm::sys::fs::remove_directories(cacheDir);
+}
@@ -0,0 +1,162 @@
+#include "memo_evaluator.hpp"
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/MathExtras.h"
+
+#include "assertion_profile.hpp"
+#include "assignment_table.hpp"
+#include "read_set.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace smt_jit {
+
+static size_t hashKey(llvm::ArrayRef<AssignmentValTy> key) {
+  return llvm::hash_combine_range(key.begin(), key.end());
+}
+
+ProjectionCache::ProjectionCache(unsigned keyLen, size_t initialCapacity)
+    : m_keyLen(keyLen) {
+  const size_t capacity =
+      llvm::PowerOf2Ceil(std::max<size_t>(initialCapacity, 4));
+  m_keys.resize(capacity * m_keyLen);
+  m_hashes.resize(capacity);
+  m_results.assign(capacity, -1);
+}
+
+size_t ProjectionCache::findSlot(llvm::ArrayRef<AssignmentValTy> key,
+                                 size_t hash) const {
+  const size_t mask = capacity() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    if (m_results[slot] < 0)
+      return slot;
+    if (m_hashes[slot] == hash &&
+        std::equal(key.begin(), key.end(), m_keys.data() + slot * m_keyLen))
+      return slot;
+  }
+}
+
+int ProjectionCache::lookup(llvm::ArrayRef<AssignmentValTy> key) const {
+  assert(key.size() == m_keyLen);
+  return m_results[findSlot(key, hashKey(key))];
+}
+
+void ProjectionCache::insert(llvm::ArrayRef<AssignmentValTy> key, int result) {
+  assert(key.size() == m_keyLen);
+  assert(result == 0 || result == 1);
+
+  // Keep the load factor under 3/4, so that probe sequences stay short.
+  if ((m_size + 1) * 4 > capacity() * 3)
+    grow();
+
+  const size_t hash = hashKey(key);
+  const size_t slot = findSlot(key, hash);
+  if (m_results[slot] < 0) {
+    std::copy(key.begin(), key.end(), m_keys.data() + slot * m_keyLen);
+    m_hashes[slot] = hash;
+    ++m_size;
+  }
+  m_results[slot] = static_cast<signed char>(result);
+}
+
+void ProjectionCache::grow() {
+  ProjectionCache grown(m_keyLen, capacity() * 2);
+  for (size_t i = 0, e = capacity(); i != e; ++i) {
+    if (m_results[i] < 0)
+      continue;
+
+    llvm::ArrayRef<AssignmentValTy> key(m_keys.data() + i * m_keyLen,
+                                        m_keyLen);
+    const size_t slot = grown.findSlot(key, m_hashes[i]);
+    std::copy(key.begin(), key.end(), grown.m_keys.data() + slot * m_keyLen);
+    grown.m_hashes[slot] = m_hashes[i];
+    grown.m_results[slot] = m_results[i];
+  }
+
+  grown.m_size = m_size;
+  *this = std::move(grown);
+}
+
+void ProjectionCache::clear() {
+  std::fill(m_results.begin(), m_results.end(), -1);
+  m_size = 0;
+}
+
+MemoEvaluator::MemoEvaluator(SmtLibParser &parser, const AssignmentTable &table,
+                             std::vector<SmtAssertionFunctionTy> assertionFns,
+                             unsigned minCost)
+    : m_table(table), m_assertionFns(std::move(assertionFns)),
+      m_caches(m_assertionFns.size()), m_keys(m_assertionFns.size()) {
+  const size_t numAssertions = parser.numAssertions();
+  assert(m_assertionFns.size() == numAssertions);
+
+  const std::vector<ReadSet> readSets = computeReadSets(parser);
+  const std::vector<unsigned> costs = estimateAssertionCosts(parser);
+
+  for (size_t k = 0; k != numAssertions; ++k) {
+    const ReadSet &readSet = readSets[k];
+    if (readSet.isSymbolic() || costs[k] < minCost)
+      continue;
+
+    const unsigned keyLen = readSet.numConstantReads();
+    m_caches[k] = llvm::make_unique<ProjectionCache>(keyLen);
+
+    std::vector<AssignmentValTy> &keys = m_keys[k];
+    keys.reserve(table.size() * keyLen);
+    for (size_t p = 0, e = table.size(); p != e; ++p) {
+      const Assignment &assignment =
+          parser.assignments()[table.getAssignmentIdx(p)];
+      for (size_t a = 0, ae = parser.numArrays(); a != ae; ++a) {
+        const auto &values = assignment.getValue(parser.arrays()[a].name);
+        for (AssignmentValTy idx : readSet.getArray(a).constantIdxs)
+          keys.push_back(readElement(values, idx));
+      }
+    }
+  }
+}
+
+size_t MemoEvaluator::numCachedAssertions() const {
+  return std::count_if(
+      m_caches.begin(), m_caches.end(),
+      [](const std::unique_ptr<ProjectionCache> &cache) { return !!cache; });
+}
+
+void MemoEvaluator::evaluate(llvm::MutableArrayRef<int> results) {
+  const size_t numAssertions = m_assertionFns.size();
+  assert(results.size() == m_table.size());
+
+  llvm::ArrayRef<bv_array **> packs = m_table.packs();
+  for (size_t p = 0, e = packs.size(); p != e; ++p) {
+    int res = 0;
+    for (size_t k = 0; k != numAssertions; ++k) {
+      ProjectionCache *cache = m_caches[k].get();
+      int holds = -1;
+      if (!cache) {
+        holds = m_assertionFns[k](packs[p]);
+      } else {
+        const unsigned keyLen = cache->keyLen();
+        llvm::ArrayRef<AssignmentValTy> key(m_keys[k].data() + p * keyLen,
+                                            keyLen);
+        holds = cache->lookup(key);
+        if (holds < 0) {
+          holds = m_assertionFns[k](packs[p]);
+          cache->insert(key, holds);
+          ++m_numMisses;
+        } else {
+          ++m_numHits;
+        }
+      }
+
+      if (holds == 0) {
+        res = k + 1;
+        break;
+      }
+    }
+
+    results[p] = res;
+  }
+}
+
+} // namespace smt_jit
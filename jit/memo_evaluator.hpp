@@ -0,0 +1,75 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+
+#include "delta_evaluator.hpp"
+#include "smtlib_parser.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace smt_jit {
+class AssignmentTable;
+
+// Open-addressing hash table (with linear probing) mapping fixed-length keys,
+// the array elements an assertion reads, to the assertion's result.
+class ProjectionCache {
+  unsigned m_keyLen;
+  size_t m_size = 0;
+  // Capacity is a power of two; m_keys holds m_keyLen values per slot.
+  std::vector<AssignmentValTy> m_keys;
+  std::vector<size_t> m_hashes;
+  // -1 marks an empty slot.
+  std::vector<signed char> m_results;
+
+  size_t findSlot(llvm::ArrayRef<AssignmentValTy> key, size_t hash) const;
+  void grow();
+
+public:
+  explicit ProjectionCache(unsigned keyLen, size_t initialCapacity = 64);
+
+  unsigned keyLen() const { return m_keyLen; }
+  size_t size() const { return m_size; }
+  size_t capacity() const { return m_results.size(); }
+
+  // Returns the cached result, or -1 if there is none.
+  int lookup(llvm::ArrayRef<AssignmentValTy> key) const;
+  void insert(llvm::ArrayRef<AssignmentValTy> key, int result);
+  void clear();
+};
+
+// Evaluates a formula assertion by assertion over the packs of an
+// AssignmentTable, looking up the results of the expensive assertions in a
+// per-assertion ProjectionCache first. The caches are keyed on the elements
+// the assertion reads, so all the assignments that agree on them share a
+// single evaluation, also across evaluate calls.
+//
+// Only assertions with constant read sets (see ReadSet) and estimated costs
+// of at least minCost are cached; the keys of every pack are projected once.
+class MemoEvaluator {
+  const AssignmentTable &m_table;
+  std::vector<SmtAssertionFunctionTy> m_assertionFns;
+  // Indexed by assertion; null for the assertions evaluated directly.
+  std::vector<std::unique_ptr<ProjectionCache>> m_caches;
+  // Projected keys of the cached assertions, for all the packs, in pack order.
+  std::vector<std::vector<AssignmentValTy>> m_keys;
+  size_t m_numHits = 0;
+  size_t m_numMisses = 0;
+
+public:
+  MemoEvaluator(SmtLibParser &parser, const AssignmentTable &table,
+                std::vector<SmtAssertionFunctionTy> assertionFns,
+                unsigned minCost);
+
+  size_t numCachedAssertions() const;
+
+  // Same results as smt_N_batch over all the packs of the table.
+  void evaluate(llvm::MutableArrayRef<int> results);
+
+  // Cache lookups of the cached assertions, over all evaluate calls.
+  size_t numHits() const { return m_numHits; }
+  size_t numMisses() const { return m_numMisses; }
+};
+
+} // namespace smt_jit
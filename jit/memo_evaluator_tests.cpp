@@ -0,0 +1,88 @@
+#include "doctest.h"
+
+#include "assertion_test_utils.hpp"
+#include "assignment_table.hpp"
+#include "memo_evaluator.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+using namespace smt_jit::test;
+
+// (bvult (bvmul (select a (_ bv1 32)) (select a (_ bv2 32))) (_ bv9 8))
+static int checkProduct(bv_array **arrays) {
+  ++numAssertionChecks();
+  return ((selectByte(arrays, 1) * selectByte(arrays, 2)) & 0xff) < 9;
+}
+
+TEST_CASE("Test projection_cache") {
+  ProjectionCache cache(2, 4);
+  CHECK(cache.lookup({1, 2}) == -1);
+
+  for (AssignmentValTy i = 0; i != 100; ++i)
+    cache.insert({i, i * 7}, i % 2);
+  CHECK(cache.size() == 100);
+  CHECK(cache.capacity() >= 128);
+
+  for (AssignmentValTy i = 0; i != 100; ++i) {
+    CHECK(cache.lookup({i, i * 7}) == int(i % 2));
+    CHECK(cache.lookup({i * 7, i + 1}) == -1);
+  }
+
+  cache.insert({3, 21}, 0);
+  CHECK(cache.size() == 100);
+  CHECK(cache.lookup({3, 21}) == 0);
+
+  cache.clear();
+  CHECK(cache.size() == 0);
+  CHECK(cache.lookup({3, 21}) == -1);
+
+  ProjectionCache constant(0);
+  constant.insert({}, 1);
+  CHECK(constant.lookup({}) == 1);
+}
+
+TEST_CASE("Test memo_evaluator") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv1 8) (select  a (_ bv0 32) ) ) )
+    (assert (bvult  (bvmul  (select  a (_ bv1 32) ) (select  a (_ bv2 32) ) ) (_ bv9 8) ) )
+    ; Assignments
+    ; { "a": [1, 2, 4, 0] }
+    ; { "a": [1, 2, 4, 1] }
+    ; { "a": [1, 3, 3, 2] }
+    ; { "a": [0, 2, 4, 3] }
+    ; { "a": [1, 2, 4, 4] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  bv_context *ctx = bv_context_create();
+  {
+    AssignmentTable table(parser, ctx);
+    // Only the second assertion is expensive enough to be cached.
+    MemoEvaluator evaluator(parser, table, {checkFirst, checkProduct}, 12);
+    CHECK(evaluator.numCachedAssertions() == 1);
+
+    std::vector<int> results(table.size());
+    numAssertionChecks() = 0;
+    evaluator.evaluate(results);
+    CHECK(results == std::vector<int>{0, 0, 2, 1, 0});
+    // Assignments 0, 1, and 4 share the product.
+    CHECK(evaluator.numMisses() == 2);
+    CHECK(evaluator.numHits() == 2);
+    CHECK(numAssertionChecks() == 7);
+
+    // The second evaluation only hits the cache.
+    numAssertionChecks() = 0;
+    evaluator.evaluate(results);
+    CHECK(results == std::vector<int>{0, 0, 2, 1, 0});
+    CHECK(evaluator.numMisses() == 2);
+    CHECK(evaluator.numHits() == 6);
+    CHECK(numAssertionChecks() == 5);
+  }
+  bv_context_destroy(ctx);
+}
@@ -0,0 +1,162 @@
+#include "opt_pipeline.hpp"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Pass.h"
+
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Vectorize.h"
+
+#include <cassert>
+
+using namespace llvm;
+
+namespace smt_jit {
+
+static const char *const ExpectedEvaluationsFlag = "smt-jit.evaluations";
+static const char *const OptPipelineFlag = "smt-jit.pipeline";
+
+StringRef getOptPipelineName(OptPipeline pipeline) {
+  switch (pipeline) {
+  case OptPipeline::None:
+    return "none";
+  case OptPipeline::Fast:
+    return "fast";
+  case OptPipeline::Default:
+    return "default";
+  case OptPipeline::Aggressive:
+    return "aggressive";
+  case OptPipeline::Auto:
+    return "auto";
+  }
+  llvm_unreachable("Unknown pipeline");
+}
+
+StringRef getInstructionSelectorName(InstructionSelector isel) {
+  switch (isel) {
+  case InstructionSelector::Fast:
+    return "fast";
+  case InstructionSelector::SelectionDAG:
+    return "dag";
+  case InstructionSelector::Global:
+    return "global";
+  }
+  llvm_unreachable("Unknown instruction selector");
+}
+
+CodeGenConfig selectCodeGenConfig(OptPipeline pipeline) {
+  switch (pipeline) {
+  case OptPipeline::None:
+    return {CodeGenOpt::None, InstructionSelector::Fast};
+  case OptPipeline::Fast:
+    return {CodeGenOpt::Less, InstructionSelector::Fast};
+  case OptPipeline::Default:
+    return {CodeGenOpt::Default, InstructionSelector::SelectionDAG};
+  case OptPipeline::Aggressive:
+    return {CodeGenOpt::Aggressive, InstructionSelector::SelectionDAG};
+  case OptPipeline::Auto:
+    break;
+  }
+  llvm_unreachable("Select a pipeline first");
+}
+
+void setExpectedEvaluations(Module &M, uint64_t numEvaluations) {
+  M.addModuleFlag(Module::Warning, ExpectedEvaluationsFlag,
+                  ConstantAsMetadata::get(ConstantInt::get(
+                      Type::getInt64Ty(M.getContext()), numEvaluations)));
+}
+
+uint64_t getExpectedEvaluations(const Module &M) {
+  auto *numEvaluations = mdconst::extract_or_null<ConstantInt>(
+      M.getModuleFlag(ExpectedEvaluationsFlag));
+  return numEvaluations ? numEvaluations->getZExtValue() : 0;
+}
+
+void setOptPipeline(Module &M, OptPipeline pipeline) {
+  M.addModuleFlag(Module::Warning, OptPipelineFlag,
+                  static_cast<uint32_t>(pipeline));
+}
+
+OptPipeline getOptPipeline(const Module &M) {
+  auto *pipeline =
+      mdconst::extract_or_null<ConstantInt>(M.getModuleFlag(OptPipelineFlag));
+  return pipeline ? static_cast<OptPipeline>(pipeline->getZExtValue())
+                  : OptPipeline::Default;
+}
+
+OptPipeline selectOptPipeline(size_t numInstructions, uint64_t numEvaluations) {
+  // Both the compile time of the pipelines and the evaluation time they save
+  // grow with the formula size, so the thresholds are on the total number of
+  // evaluated instructions.
+  const uint64_t work = numInstructions * numEvaluations;
+  if (work < (uint64_t(1) << 16))
+    return OptPipeline::None;
+  if (work < (uint64_t(1) << 20))
+    return OptPipeline::Fast;
+  if (work < (uint64_t(1) << 26))
+    return OptPipeline::Default;
+  return OptPipeline::Aggressive;
+}
+
+OptPipeline selectOptPipeline(const Module &M) {
+  const uint64_t numEvaluations = getExpectedEvaluations(M);
+  if (numEvaluations == 0)
+    return OptPipeline::Default;
+
+  size_t numInstructions = 0;
+  for (const Function &F : M)
+    if (!F.isDeclaration() && F.getName().startswith("smt_"))
+      numInstructions += F.getInstructionCount();
+
+  return selectOptPipeline(numInstructions, numEvaluations);
+}
+
+void addOptPipelinePasses(legacy::FunctionPassManager &FPM,
+                          OptPipeline pipeline, bool vectorize) {
+  assert(pipeline != OptPipeline::Auto && "Select a pipeline first");
+  const bool aggressive = pipeline == OptPipeline::Aggressive;
+
+  switch (pipeline) {
+  case OptPipeline::None:
+  case OptPipeline::Auto:
+    return;
+  case OptPipeline::Fast:
+    FPM.add(createEarlyCSEPass());
+    return;
+  case OptPipeline::Default:
+  case OptPipeline::Aggressive:
+    break;
+  }
+
+  FPM.add(createInstructionCombiningPass());
+  if (aggressive) {
+    FPM.add(createSCCPPass());
+    FPM.add(createReassociatePass());
+  }
+  FPM.add(createGVNPass());
+  if (vectorize) {
+    // Pack the isomorphic lanes of the vectorized formula variant.
+    FPM.add(createSLPVectorizerPass());
+    FPM.add(createInstructionCombiningPass());
+  }
+
+  if (!aggressive) {
+    FPM.add(createCFGSimplificationPass());
+    return;
+  }
+
+  FPM.add(createAggressiveDCEPass());
+  // Also turn the chains of comparisons into switches, and the switches into
+  // lookup tables.
+  FPM.add(createCFGSimplificationPass(/* Threshold = */ 1,
+                                      /* ForwardSwitchCond = */ true,
+                                      /* ConvertSwitch = */ true,
+                                      /* KeepLoops = */ true,
+                                      /* SinkCommon = */ true));
+}
+
+} // namespace smt_jit
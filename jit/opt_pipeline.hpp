@@ -0,0 +1,76 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace smt_jit {
+
+// IR optimization pipelines of the formula modules, from the cheapest to
+// compile to the one producing the fastest code. The always inliner runs
+// before all of them but None.
+enum class OptPipeline {
+  // No optimizations at all.
+  None,
+  // EarlyCSE only.
+  Fast,
+  // InstCombine, GVN, and SimplifyCFG.
+  Default,
+  // Default plus SCCP, Reassociate, ADCE, and switch formation.
+  Aggressive,
+  // One of the above, picked by selectOptPipeline.
+  Auto,
+};
+
+llvm::StringRef getOptPipelineName(OptPipeline pipeline);
+
+enum class InstructionSelector { Fast, SelectionDAG, Global };
+
+llvm::StringRef getInstructionSelectorName(InstructionSelector isel);
+
+// Code generator settings of a formula module.
+struct CodeGenConfig {
+  llvm::CodeGenOpt::Level optLevel;
+  InstructionSelector isel;
+};
+
+// Returns the code generator settings that go with the IR pipeline, which
+// must not be Auto: the cheap pipelines get the fast instruction selector at
+// a low optimization level, and the others SelectionDAG at the optimization
+// level matching theirs.
+CodeGenConfig selectCodeGenConfig(OptPipeline pipeline);
+
+// Records how many times the formula module will be evaluated (e.g., the
+// number of assignments times the benchmark iterations), for the Auto
+// pipeline.
+void setExpectedEvaluations(llvm::Module &M, uint64_t numEvaluations);
+// Returns 0 if the module has no expected number of evaluations.
+uint64_t getExpectedEvaluations(const llvm::Module &M);
+
+// Records the pipeline the module is optimized with, so that its code can be
+// generated with the matching settings.
+void setOptPipeline(llvm::Module &M, OptPipeline pipeline);
+// Returns Default if the module has no recorded pipeline.
+OptPipeline getOptPipeline(const llvm::Module &M);
+
+// Picks the pipeline for a formula of numInstructions instructions (before
+// inlining), evaluated numEvaluations times: the more instructions are
+// executed in total, the more optimization pays off.
+OptPipeline selectOptPipeline(size_t numInstructions, uint64_t numEvaluations);
+
+// Picks the pipeline for the smt_ functions of the module, based on their
+// size and the expected evaluations. Modules without the expected
+// evaluations, e.g., the shared assertions, get the Default pipeline.
+OptPipeline selectOptPipeline(const llvm::Module &M);
+
+// Adds the function passes of the pipeline, which must not be Auto. With
+// vectorize, the Default and Aggressive pipelines also run the SLP
+// vectorizer.
+void addOptPipelinePasses(llvm::legacy::FunctionPassManager &FPM,
+                          OptPipeline pipeline, bool vectorize);
+
+} // namespace smt_jit
@@ -0,0 +1,65 @@
+#include "doctest.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include "opt_pipeline.hpp"
+
+using namespace smt_jit;
+
+TEST_CASE("Test opt_pipeline_selection") {
+  // Small formulas evaluated a few times are not worth optimizing.
+  CHECK(selectOptPipeline(100, 10) == OptPipeline::None);
+  CHECK(selectOptPipeline(100, 1000) == OptPipeline::Fast);
+  CHECK(selectOptPipeline(1000, 10000) == OptPipeline::Default);
+  CHECK(selectOptPipeline(1000, 100000) == OptPipeline::Aggressive);
+
+  // More instructions or more evaluations never pick a cheaper pipeline.
+  OptPipeline previous = OptPipeline::None;
+  for (uint64_t evaluations = 1; evaluations < (uint64_t(1) << 30);
+       evaluations *= 4) {
+    const OptPipeline selected = selectOptPipeline(64, evaluations);
+    CHECK(selected >= previous);
+    CHECK(selected != OptPipeline::Auto);
+    previous = selected;
+  }
+}
+
+TEST_CASE("Test opt_pipeline_expected_evaluations") {
+  llvm::LLVMContext ctx;
+  llvm::Module M("formula", ctx);
+
+  // Modules without the expected evaluations (bvlib, shared assertions) get
+  // the default pipeline.
+  CHECK(getExpectedEvaluations(M) == 0);
+  CHECK(selectOptPipeline(M) == OptPipeline::Default);
+
+  setExpectedEvaluations(M, uint64_t(1) << 40);
+  CHECK(getExpectedEvaluations(M) == uint64_t(1) << 40);
+
+  // No smt_ functions, nothing to optimize.
+  CHECK(selectOptPipeline(M) == OptPipeline::None);
+}
+
+TEST_CASE("Test opt_pipeline_codegen_config") {
+  llvm::LLVMContext ctx;
+  llvm::Module M("formula", ctx);
+  CHECK(getOptPipeline(M) == OptPipeline::Default);
+
+  setOptPipeline(M, OptPipeline::Fast);
+  CHECK(getOptPipeline(M) == OptPipeline::Fast);
+
+  // The cheap pipelines get the fast instruction selector.
+  const CodeGenConfig none = selectCodeGenConfig(OptPipeline::None);
+  CHECK(none.optLevel == llvm::CodeGenOpt::None);
+  CHECK(none.isel == InstructionSelector::Fast);
+  CHECK(selectCodeGenConfig(OptPipeline::Fast).isel ==
+        InstructionSelector::Fast);
+
+  const CodeGenConfig aggressive =
+      selectCodeGenConfig(OptPipeline::Aggressive);
+  CHECK(aggressive.optLevel == llvm::CodeGenOpt::Aggressive);
+  CHECK(aggressive.isel == InstructionSelector::SelectionDAG);
+  CHECK(selectCodeGenConfig(OptPipeline::Default).optLevel ==
+        llvm::CodeGenOpt::Default);
+}
@@ -0,0 +1,175 @@
+#include "read_set.hpp"
+
+#include "llvm/ADT/StringMap.h"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+namespace smt_jit {
+
+namespace {
+// Matches (_ bvN W).
+bool getConstantIndex(sexpresso::Sexp &sexp, AssignmentValTy &idx) {
+  if (!sexp.isSexp() || sexp.childCount() != 3)
+    return false;
+
+  sexpresso::Sexp &head = sexp.getHead();
+  sexpresso::Sexp &literal = sexp.getChild(1);
+  if (!head.isString() || head.getString() != "_" || !literal.isString())
+    return false;
+
+  const std::string &str = literal.getString();
+  if (str.size() < 3 || str.compare(0, 2, "bv") != 0 ||
+      !std::all_of(str.begin() + 2, str.end(), ::isdigit))
+    return false;
+
+  idx = std::stoull(str.substr(2));
+  return true;
+}
+
+void collectReads(sexpresso::Sexp &sexp,
+                  const llvm::StringMap<unsigned> &arrayIdxs,
+                  std::vector<ArrayReadSet> &reads) {
+  if (!sexp.isSexp())
+    return;
+
+  const size_t numChildren = sexp.childCount();
+  if (numChildren == 3 && sexp.getHead().isString() &&
+      sexp.getHead().getString() == "select") {
+    sexpresso::Sexp &arr = sexp.getChild(1);
+    auto arrIt = arr.isString() ? arrayIdxs.find(arr.getString())
+                                : arrayIdxs.end();
+    AssignmentValTy idx = 0;
+    if (arrIt == arrayIdxs.end()) {
+      // Not a declared array, conservatively assume it can be any of them.
+      for (ArrayReadSet &arrayReads : reads)
+        arrayReads.symbolic = true;
+    } else if (getConstantIndex(sexp.getChild(2), idx)) {
+      reads[arrIt->second].constantIdxs.push_back(idx);
+    } else {
+      reads[arrIt->second].symbolic = true;
+    }
+  }
+
+  for (size_t i = 0; i != numChildren; ++i)
+    collectReads(sexp.getChild(i), arrayIdxs, reads);
+}
+} // namespace
+
+bool ArrayReadSet::mayRead(AssignmentValTy idx) const {
+  return symbolic ||
+         std::binary_search(constantIdxs.begin(), constantIdxs.end(), idx);
+}
+
+bool ReadSet::isSymbolic() const {
+  return std::any_of(m_arrays.begin(), m_arrays.end(),
+                     [](const ArrayReadSet &reads) { return reads.symbolic; });
+}
+
+size_t ReadSet::numConstantReads() const {
+  size_t res = 0;
+  for (const ArrayReadSet &reads : m_arrays)
+    res += reads.constantIdxs.size();
+  return res;
+}
+
+bool ReadSet::overlaps(const ReadSet &other) const {
+  assert(numArrays() == other.numArrays());
+
+  for (size_t a = 0, e = numArrays(); a != e; ++a) {
+    const ArrayReadSet &lhs = m_arrays[a];
+    const ArrayReadSet &rhs = other.m_arrays[a];
+    if (lhs.empty() || rhs.empty())
+      continue;
+    if (lhs.symbolic || rhs.symbolic)
+      return true;
+
+    // Both index lists are sorted.
+    auto lhsIt = lhs.constantIdxs.begin();
+    auto rhsIt = rhs.constantIdxs.begin();
+    while (lhsIt != lhs.constantIdxs.end() && rhsIt != rhs.constantIdxs.end()) {
+      if (*lhsIt == *rhsIt)
+        return true;
+      if (*lhsIt < *rhsIt)
+        ++lhsIt;
+      else
+        ++rhsIt;
+    }
+  }
+
+  return false;
+}
+
+bool ReadSet::differs(llvm::ArrayRef<ArrayInfo> arrays, const Assignment &lhs,
+                      const Assignment &rhs) const {
+  assert(arrays.size() == numArrays());
+
+  for (size_t a = 0, e = numArrays(); a != e; ++a) {
+    const ArrayReadSet &reads = m_arrays[a];
+    if (reads.empty())
+      continue;
+
+    const auto &lhsValues = lhs.getValue(arrays[a].name);
+    const auto &rhsValues = rhs.getValue(arrays[a].name);
+    if (lhsValues == rhsValues)
+      continue;
+    if (reads.symbolic)
+      return true;
+
+    for (AssignmentValTy idx : reads.constantIdxs)
+      if (readElement(lhsValues, idx) != readElement(rhsValues, idx))
+        return true;
+  }
+
+  return false;
+}
+
+void ReadSet::dump(llvm::ArrayRef<ArrayInfo> arrays,
+                   llvm::raw_ostream &os) const {
+  assert(arrays.size() == numArrays());
+
+  os << "ReadSet {";
+  for (size_t a = 0, e = numArrays(); a != e; ++a) {
+    const ArrayReadSet &reads = m_arrays[a];
+    if (reads.empty())
+      continue;
+
+    os << " " << arrays[a].name << ": [";
+    if (reads.symbolic)
+      os << "*";
+    for (size_t i = 0, ie = reads.constantIdxs.size(); i != ie; ++i)
+      os << (i == 0 && !reads.symbolic ? "" : ", ") << reads.constantIdxs[i];
+    os << "]";
+  }
+  os << " }\n";
+}
+
+ReadSet computeReadSet(sexpresso::Sexp &assertion,
+                       llvm::ArrayRef<ArrayInfo> arrays) {
+  llvm::StringMap<unsigned> arrayIdxs;
+  for (size_t a = 0, e = arrays.size(); a != e; ++a)
+    arrayIdxs[arrays[a].name] = a;
+
+  ReadSet readSet(arrays.size());
+  collectReads(assertion, arrayIdxs, readSet.m_arrays);
+
+  for (ArrayReadSet &reads : readSet.m_arrays) {
+    std::vector<AssignmentValTy> &idxs = reads.constantIdxs;
+    std::sort(idxs.begin(), idxs.end());
+    idxs.erase(std::unique(idxs.begin(), idxs.end()), idxs.end());
+  }
+
+  return readSet;
+}
+
+std::vector<ReadSet> computeReadSets(SmtLibParser &parser) {
+  std::vector<ReadSet> readSets;
+  readSets.reserve(parser.numAssertions());
+  for (sexpresso::Sexp &assertion : parser.assertions())
+    readSets.push_back(computeReadSet(assertion, parser.arrays()));
+
+  return readSets;
+}
+
+} // namespace smt_jit
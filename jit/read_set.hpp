@@ -0,0 +1,70 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "smtlib_parser.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace smt_jit {
+
+// Elements of a single array read by an assertion.
+struct ArrayReadSet {
+  // Indices of the selects with constant indices; sorted and unique.
+  std::vector<AssignmentValTy> constantIdxs;
+  // Set if the array is also read at a non-constant index, i.e., any of its
+  // elements may be read.
+  bool symbolic = false;
+
+  bool empty() const { return constantIdxs.empty() && !symbolic; }
+  bool mayRead(AssignmentValTy idx) const;
+};
+
+// The array elements an assertion reads, computed statically from its selects.
+// Selects at indices of the form (_ bvN W) read exactly the element N.
+class ReadSet {
+  std::vector<ArrayReadSet> m_arrays;
+
+  friend ReadSet computeReadSet(sexpresso::Sexp &assertion,
+                                llvm::ArrayRef<ArrayInfo> arrays);
+
+public:
+  explicit ReadSet(size_t numArrays) : m_arrays(numArrays) {}
+
+  size_t numArrays() const { return m_arrays.size(); }
+  // Indexed like SmtLibParser::arrays.
+  const ArrayReadSet &getArray(size_t arrayIdx) const {
+    return m_arrays[arrayIdx];
+  }
+
+  bool isSymbolic() const;
+  size_t numConstantReads() const;
+
+  // Returns true if both read sets may contain the same element. Assertions
+  // with non-overlapping read sets are independent.
+  bool overlaps(const ReadSet &other) const;
+
+  // Returns true if the assignments differ at an element in the read set, i.e.,
+  // if the assertion may evaluate differently under them.
+  bool differs(llvm::ArrayRef<ArrayInfo> arrays, const Assignment &lhs,
+               const Assignment &rhs) const;
+
+  void dump(llvm::ArrayRef<ArrayInfo> arrays,
+            llvm::raw_ostream &os = llvm::errs()) const;
+};
+
+ReadSet computeReadSet(sexpresso::Sexp &assertion,
+                       llvm::ArrayRef<ArrayInfo> arrays);
+// Read sets of all the assertions, in the assertion order.
+std::vector<ReadSet> computeReadSets(SmtLibParser &parser);
+
+// Value of an array element; the elements past the end of the assignment read
+// as 0, same as in bvlib.
+inline AssignmentValTy readElement(const Assignment::AssignmentVector &values,
+                                   AssignmentValTy idx) {
+  return idx < values.size() ? values[idx] : 0;
+}
+
+} // namespace smt_jit
@@ -0,0 +1,84 @@
+#include "doctest.h"
+
+#include "read_set.hpp"
+#include "smtlib_parser.hpp"
+
+#include <sstream>
+#include <vector>
+
+using namespace smt_jit;
+
+TEST_CASE("Test read_set_constant_indices") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv513 16) (concat  (select  a (_ bv3 32) ) (select  a (_ bv1 32) ) ) ) )
+    (assert (bvult  (select  b (_ bv0 32) ) (select  a (_ bv3 32) ) ) )
+    (assert (=  (_ bv7 8) (select  b (_ bv2 32) ) ) )
+    ; Assignments
+    ; { "a": [0, 1, 2, 3], "b": [4, 5, 6] }
+    ; { "a": [0, 1, 9, 3], "b": [4, 5, 7] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  const std::vector<ReadSet> readSets = computeReadSets(parser);
+  REQUIRE(readSets.size() == 3);
+  for (const ReadSet &readSet : readSets)
+    readSet.dump(parser.arrays());
+
+  const ReadSet &first = readSets[0];
+  CHECK(!first.isSymbolic());
+  CHECK(first.numConstantReads() == 2);
+  CHECK(first.getArray(0).constantIdxs == std::vector<AssignmentValTy>{1, 3});
+  CHECK(first.getArray(1).empty());
+  CHECK(first.getArray(0).mayRead(3));
+  CHECK(!first.getArray(0).mayRead(2));
+
+  // Reads of the same element are only recorded once.
+  CHECK(readSets[1].numConstantReads() == 2);
+
+  CHECK(first.overlaps(readSets[1]));
+  CHECK(!first.overlaps(readSets[2]));
+  CHECK(!readSets[1].overlaps(readSets[2]));
+
+  const Assignment &lhs = parser.assignments()[0];
+  const Assignment &rhs = parser.assignments()[1];
+  CHECK(!first.differs(parser.arrays(), lhs, rhs));
+  CHECK(!readSets[1].differs(parser.arrays(), lhs, rhs));
+  CHECK(readSets[2].differs(parser.arrays(), lhs, rhs));
+}
+
+TEST_CASE("Test read_set_symbolic_index") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvult  (select  a (concat  (_ bv0 24) (select  b (_ bv1 32) ) ) ) (_ bv5 8) ) )
+    (assert (=  (_ bv7 8) (select  b (_ bv2 32) ) ) )
+    ; Assignments
+    ; { "a": [0, 1], "b": [4, 1] }
+    ; { "a": [0, 1, 0], "b": [4, 1] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  const std::vector<ReadSet> readSets = computeReadSets(parser);
+  REQUIRE(readSets.size() == 2);
+
+  const ReadSet &first = readSets[0];
+  CHECK(first.isSymbolic());
+  CHECK(first.getArray(0).symbolic);
+  CHECK(first.getArray(0).mayRead(42));
+  CHECK(!first.getArray(1).symbolic);
+  CHECK(first.getArray(1).constantIdxs == std::vector<AssignmentValTy>{1});
+
+  CHECK(first.overlaps(first));
+  CHECK(!first.overlaps(readSets[1]));
+
+  // Any change to a symbolically read array counts, even if reads past the end
+  // see the same value.
+  const Assignment &lhs = parser.assignments()[0];
+  const Assignment &rhs = parser.assignments()[1];
+  CHECK(first.differs(parser.arrays(), lhs, rhs));
+  CHECK(!readSets[1].differs(parser.arrays(), lhs, rhs));
+}
@@ -9,6 +9,8 @@
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 
 #include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
@@ -16,30 +18,37 @@
 #include "llvm/IR/Verifier.h"
 
 #include "llvm/Bitcode/BitcodeWriter.h"
-#include "llvm/IRReader/IRReader.h"
 
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
-#include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "llvm/Analysis/CallGraphSCCPass.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Target/TargetMachine.h"
 
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
 
 #include "z3.h"
 
+#include "assertion_profile.hpp"
+#include "assignment_table.hpp"
 #include "bvlib_cloner.hpp"
+#include "bytecode.hpp"
+#include "delta_evaluator.hpp"
+#include "evaluator.hpp"
+#include "formula_cache.hpp"
+#include "memo_evaluator.hpp"
+#include "opt_pipeline.hpp"
 
 #include "bvlib/bvlib.h"
 #include "sexpresso.hpp"
@@ -47,8 +56,16 @@
 #include "smtlib_to_llvm.hpp"
 #include "support.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define DEBUG_TYPE "smt-jit"
 
@@ -70,6 +87,12 @@ static llvm::cl::opt<std::string>
     TempDir("temp-dir", llvm::cl::desc("Temporary file directory"),
             llvm::cl::init("."), llvm::cl::value_desc("filename"));
 
+static llvm::cl::opt<std::string> CacheDir(
+    "cache-dir",
+    llvm::cl::desc("[smt-jit] Directory of the persistent object cache of "
+                   "compiled formulas (empty disables it)"),
+    llvm::cl::init(""), llvm::cl::value_desc("directory"));
+
 static llvm::cl::opt<bool>
     BenchmarkMode("benchmark",
                   llvm::cl::desc("[smt-jit] Run in benchmarking mode"),
@@ -80,33 +103,255 @@ static llvm::cl::opt<unsigned> BenchmarkIterations(
     llvm::cl::desc("[smt-jit] Number of iterations (for benchmarking)"),
     llvm::cl::init(10000));
 
-static std::string LastTempModulePath;
+static llvm::cl::opt<unsigned> Lanes(
+    "lanes",
+    llvm::cl::desc("[smt-jit] Evaluate this many assignments at once with the "
+                   "vectorized formula variant (0 disables it)"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<unsigned> Threads(
+    "threads",
+    llvm::cl::desc("[smt-jit] Number of threads evaluating the assignments"),
+    llvm::cl::init(1));
+
+static llvm::cl::opt<unsigned> Jobs(
+    "jobs",
+    llvm::cl::desc("[smt-jit] Number of formulas compiled concurrently, "
+                   "ahead of the evaluation of the input files in order"),
+    llvm::cl::init(1));
+
+static llvm::cl::opt<unsigned> CompileAhead(
+    "compile-ahead",
+    llvm::cl::desc("[smt-jit] Compile up to this many input files ahead of "
+                   "the one being evaluated, on separate threads (0 disables "
+                   "it; --jobs=N compiles at least N files ahead)"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<bool> FirstModel(
+    "first-model",
+    llvm::cl::desc("[smt-jit] Stop at the first assignment that models the "
+                   "formula and report its index"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> ReorderAfter(
+    "reorder-after",
+    llvm::cl::desc("[smt-jit] Profile assertion failures over this many "
+                   "assignments and recompile each formula with the most "
+                   "selective assertions first (0 disables it)"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<bool> Dual(
+    "dual",
+    llvm::cl::desc("[smt-jit] Treat the last assertion as a query expression "
+                   "and evaluate it under the remaining constraints"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> Delta(
+    "delta",
+    llvm::cl::desc("[smt-jit] Evaluate the assertions separately and reuse "
+                   "their results across assignments that only differ at "
+                   "indices they do not read"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> ShareAssertions(
+    "share-assertions",
+    llvm::cl::desc("[smt-jit] Compile every canonical assertion once and "
+                   "share it between all the formulas it appears in"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<bool> LiftConstants(
+    "lift-constants",
+    llvm::cl::desc("[smt-jit] Share assertions that only differ in their "
+                   "bitvector literals; implies --share-assertions"),
+    llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> MemoMinCost(
+    "memo-min-cost",
+    llvm::cl::desc("[smt-jit] Cache the results of assertions of at least "
+                   "this cost, keyed on the array elements they read "
+                   "(0 disables it)"),
+    llvm::cl::init(0));
+
+enum class EngineKind { Jit, Interp };
+
+static llvm::cl::opt<EngineKind> Engine(
+    "engine", llvm::cl::desc("[smt-jit] Formula evaluation engine"),
+    llvm::cl::values(
+        clEnumValN(EngineKind::Jit, "jit", "Compile formulas with LLVM"),
+        clEnumValN(EngineKind::Interp, "interp",
+                   "Interpret formulas as bytecode, without compilation")),
+    llvm::cl::init(EngineKind::Jit));
+
+static llvm::cl::opt<smt_jit::OptPipeline> Pipeline(
+    "opt-pipeline",
+    llvm::cl::desc("[smt-jit] IR optimization pipeline of the formulas"),
+    llvm::cl::values(
+        clEnumValN(smt_jit::OptPipeline::None, "none", "No optimizations"),
+        clEnumValN(smt_jit::OptPipeline::Fast, "fast",
+                   "Inlining and EarlyCSE"),
+        clEnumValN(smt_jit::OptPipeline::Default, "default",
+                   "Inlining, InstCombine, GVN, and SimplifyCFG"),
+        clEnumValN(smt_jit::OptPipeline::Aggressive, "aggressive",
+                   "Default plus SCCP, Reassociate, ADCE, and switch "
+                   "formation"),
+        clEnumValN(smt_jit::OptPipeline::Auto, "auto",
+                   "Pick one by the formula size and the number of "
+                   "evaluations")),
+    llvm::cl::init(smt_jit::OptPipeline::Default));
+
+// Unless given, the code generator settings follow the IR pipeline of each
+// formula.
+static llvm::cl::opt<unsigned> CodeGenOptLevel(
+    "codegen-opt",
+    llvm::cl::desc("[smt-jit] Code generator optimization level of the "
+                   "formulas (0-3). Matches the IR pipeline by default"));
+
+static llvm::cl::opt<smt_jit::InstructionSelector> ISel(
+    "isel",
+    llvm::cl::desc("[smt-jit] Instruction selector of the formulas. Matches "
+                   "the IR pipeline by default"),
+    llvm::cl::values(
+        clEnumValN(smt_jit::InstructionSelector::Fast, "fast", "FastISel"),
+        clEnumValN(smt_jit::InstructionSelector::SelectionDAG, "dag",
+                   "SelectionDAG"),
+        clEnumValN(smt_jit::InstructionSelector::Global, "global",
+                   "GlobalISel, falling back to SelectionDAG (experimental "
+                   "on x86)")),
+    llvm::cl::init(smt_jit::InstructionSelector::SelectionDAG));
+
+// Salt of the formula hashes: the bvlib version, target, and flags that affect
+// the object code.
+static std::string FormulaCacheEnvironment;
+
+// The optimized bvlib bitcode, embedded by the build.
+static const unsigned char BVLibBitcode[] = {
+#include "bvlib_bitcode.inc"
+};
+
+// Time a thread spent optimizing and generating code. Modules are
+// materialized in the thread that looks their symbols up, so the differences
+// across a compilation are the times of the formula it compiles.
+struct CompilationTimers {
+  std::chrono::microseconds Optimization{0};
+  std::chrono::microseconds CodeGen{0};
+};
+static thread_local CompilationTimers ThreadCompilationTimers;
+
+// The key of the module being materialized in this thread. The module goes
+// through the optimization, compilation, and object layers in the thread
+// that looks it up, without other materializations in between.
+static thread_local orc::VModuleKey MaterializingKey;
+
+// Allocates the sections of a formula object in memory owned by the formula.
+// RTDyldObjectLinkingLayer keeps its memory managers until it is destroyed,
+// so it only keeps these forwarders once the formula is released.
+class FormulaMemoryManager : public RuntimeDyld::MemoryManager {
+  std::weak_ptr<SectionMemoryManager> MemMgr;
+
+public:
+  explicit FormulaMemoryManager(std::weak_ptr<SectionMemoryManager> MemMgr)
+      : MemMgr(std::move(MemMgr)) {}
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    return MemMgr.lock()->allocateCodeSection(Size, Alignment, SectionID,
+                                              SectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    return MemMgr.lock()->allocateDataSection(Size, Alignment, SectionID,
+                                              SectionName, IsReadOnly);
+  }
+
+  void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr,
+                        size_t Size) override {
+    MemMgr.lock()->registerEHFrames(Addr, LoadAddr, Size);
+  }
+
+  void deregisterEHFrames() override {
+    // Released formulas have deregistered theirs.
+    if (std::shared_ptr<SectionMemoryManager> Locked = MemMgr.lock())
+      Locked->deregisterEHFrames();
+  }
+
+  bool finalizeMemory(std::string *ErrMsg = nullptr) override {
+    return MemMgr.lock()->finalizeMemory(ErrMsg);
+  }
+};
 
 class SmtJit {
 private:
+  // A formula in a JITDylib of its own, together with the memory of its code,
+  // so that releaseFormula can free both. The formulas are declared before
+  // the layers, which deregister the EH frames in their memory when
+  // destroyed.
+  struct FormulaUnit {
+    orc::JITDylib *JD = nullptr;
+    std::string Name;
+    orc::SymbolNameSet Symbols;
+    std::vector<std::shared_ptr<SectionMemoryManager>> MemMgrs;
+    unsigned Uses = 1;
+  };
+  std::mutex UnitsMutex;
+  std::map<orc::VModuleKey, FormulaUnit> Units;
+  StringMap<orc::VModuleKey> UnitsByName;
+  // JITDylibs cannot be removed from the session, so the ones of the
+  // released formulas are reused.
+  std::vector<orc::JITDylib *> FreeDylibs;
+  unsigned NumDylibs = 0;
+
   orc::ExecutionSession ES;
   orc::RTDyldObjectLinkingLayer ObjectLayer;
   orc::IRCompileLayer CompileLayer;
   orc::IRTransformLayer OptimizeLayer;
 
+  orc::JITTargetMachineBuilder JTMB;
+  std::unique_ptr<TargetMachine> TM;
   DataLayout DL;
   orc::MangleAndInterner Mangle;
   orc::ThreadSafeContext Ctx;
+  smt_jit::FormulaObjectCache *ObjCache;
+
+  // Shared assertion functions (smt_assert_H), visible to all the formulas.
+  orc::JITDylib *SharedJD = nullptr;
+  StringSet<> SharedAssertions;
+  unsigned NumSharedAssertionUses = 0;
+
+  // Held while claiming and adding modules that more than one formula may
+  // use, so that no thread looks up a symbol that another thread claimed but
+  // has not added yet.
+  std::mutex AddMutex;
 
 public:
-  SmtJit(orc::JITTargetMachineBuilder JTMB, DataLayout DL)
-      : ObjectLayer(ES,
-                    []() { return llvm::make_unique<SectionMemoryManager>(); }),
+  SmtJit(orc::JITTargetMachineBuilder JTMB, std::unique_ptr<TargetMachine> TM,
+         smt_jit::FormulaObjectCache *ObjCache)
+      : ObjectLayer(ES, [this]() { return createMemoryManager(); }),
         CompileLayer(ES, ObjectLayer,
-                     orc::ConcurrentIRCompiler(std::move(JTMB))),
-        OptimizeLayer(ES, CompileLayer, optimizeModule), DL(std::move(DL)),
-        Mangle(ES, this->DL), Ctx(llvm::make_unique<LLVMContext>()) {
+                     [this](Module &M) { return compileModule(M); }),
+        OptimizeLayer(ES, CompileLayer,
+                      [this](orc::ThreadSafeModule TSM,
+                             const orc::MaterializationResponsibility &R) {
+                        return optimizeModule(std::move(TSM), R);
+                      }),
+        JTMB(std::move(JTMB)), TM(std::move(TM)),
+        DL(this->TM->createDataLayout()), Mangle(ES, this->DL),
+        Ctx(llvm::make_unique<LLVMContext>()), ObjCache(ObjCache) {
     ES.getMainJITDylib().setGenerator(
         cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
             DL.getGlobalPrefix())));
+
+    // The formulas link against the shared assertions, and both link against
+    // bvlib in the main JITDylib.
+    SharedJD = &ES.createJITDylib("smt-shared",
+                                  /* AddToMainDylibSearchOrder = */ false);
+    SharedJD->addToSearchOrder(ES.getMainJITDylib());
   }
 
-  static Expected<std::unique_ptr<SmtJit>> Create() {
+  static Expected<std::unique_ptr<SmtJit>>
+  Create(smt_jit::FormulaObjectCache *ObjCache = nullptr) {
     auto JTMB = orc::JITTargetMachineBuilder::detectHost();
 
     if (!JTMB)
@@ -119,42 +364,208 @@ public:
     }
 
     std::unique_ptr<TargetMachine> TM = std::move(errTM.get());
-
-    auto DL = TM->createDataLayout();
-    return llvm::make_unique<SmtJit>(std::move(*JTMB), DL);
+    return llvm::make_unique<SmtJit>(std::move(*JTMB), std::move(TM),
+                                     ObjCache);
   }
 
   const DataLayout &getDataLayout() const { return DL; }
+  const TargetMachine &getTargetMachine() const { return *TM; }
+  bool hasObjectCache() const { return ObjCache != nullptr; }
 
   LLVMContext &getContext() { return *Ctx.getContext(); }
+  orc::ThreadSafeContext getThreadSafeContext() { return Ctx; }
 
   Error addModule(std::unique_ptr<Module> M) {
-    return OptimizeLayer.add(ES.getMainJITDylib(),
-                             orc::ThreadSafeModule(std::move(M), Ctx));
+    return addModule(orc::ThreadSafeModule(std::move(M), Ctx));
+  }
+
+  Error addModule(orc::ThreadSafeModule TSM) {
+    return OptimizeLayer.add(ES.getMainJITDylib(), std::move(TSM));
+  }
+
+  std::unique_lock<std::mutex> lockAdditions() {
+    return std::unique_lock<std::mutex>(AddMutex);
+  }
+
+  // Returns true if the shared assertion has not been added before, i.e., if
+  // the caller has to add it with addSharedModule. The caller has to hold
+  // lockAdditions until then.
+  bool claimSharedAssertion(StringRef Name) {
+    ++NumSharedAssertionUses;
+    return SharedAssertions.insert(Name).second;
+  }
+
+  unsigned getNumSharedAssertions() const { return SharedAssertions.size(); }
+  unsigned getNumSharedAssertionUses() const { return NumSharedAssertionUses; }
+
+  Error addSharedModule(std::unique_ptr<Module> M) {
+    return addSharedModule(orc::ThreadSafeModule(std::move(M), Ctx));
+  }
+
+  Error addSharedModule(orc::ThreadSafeModule TSM) {
+    return OptimizeLayer.add(*SharedJD, std::move(TSM));
+  }
+
+  // Adds the formula module to a JITDylib of its own, and returns the key to
+  // look up its symbols and to release it with. The caller has to hold
+  // lockAdditions.
+  Expected<orc::VModuleKey> addFormulaModule(StringRef Name,
+                                             orc::ThreadSafeModule TSM) {
+    FormulaUnit Unit;
+    Unit.Name = Name;
+    {
+      // The symbols the layers define for the module.
+      auto Lock = TSM.getContextLock();
+      for (GlobalValue &G : TSM.getModule()->global_values())
+        if (G.hasName() && !G.isDeclaration() && !G.hasLocalLinkage() &&
+            !G.hasAvailableExternallyLinkage() && !G.hasAppendingLinkage())
+          Unit.Symbols.insert(Mangle(G.getName()));
+    }
+
+    const orc::VModuleKey K = ES.allocateVModule();
+    orc::JITDylib *JD;
+    {
+      std::lock_guard<std::mutex> Lock(UnitsMutex);
+      if (FreeDylibs.empty()) {
+        JD = &ES.createJITDylib("smt-formula-" + std::to_string(NumDylibs++),
+                                /* AddToMainDylibSearchOrder = */ false);
+        JD->addToSearchOrder(*SharedJD);
+        JD->addToSearchOrder(ES.getMainJITDylib());
+      } else {
+        JD = FreeDylibs.back();
+        FreeDylibs.pop_back();
+      }
+      Unit.JD = JD;
+      UnitsByName[Name] = K;
+      Units[K] = std::move(Unit);
+    }
+
+    if (Error Err = OptimizeLayer.add(*JD, std::move(TSM), K)) {
+      std::lock_guard<std::mutex> Lock(UnitsMutex);
+      UnitsByName.erase(Name);
+      Units.erase(K);
+      FreeDylibs.push_back(JD);
+      return std::move(Err);
+    }
+    return K;
+  }
+
+  // Returns the key of the formula if it has been added under this name and
+  // not released since, and makes it take one more releaseFormula to release.
+  // The caller has to hold lockAdditions.
+  Optional<orc::VModuleKey> retainFormula(StringRef Name) {
+    std::lock_guard<std::mutex> Lock(UnitsMutex);
+    auto I = UnitsByName.find(Name);
+    if (I == UnitsByName.end())
+      return None;
+    ++Units[I->second].Uses;
+    return I->second;
+  }
+
+  // Removes the symbols of the formula, together with the parts of its
+  // module that have not been compiled, and frees its code. Its functions
+  // must not be running.
+  Error releaseFormula(orc::VModuleKey K) {
+    FormulaUnit Unit;
+    {
+      std::lock_guard<std::mutex> Lock(UnitsMutex);
+      auto I = Units.find(K);
+      assert(I != Units.end() && "Formula released too many times");
+      if (--I->second.Uses != 0)
+        return Error::success();
+      Unit = std::move(I->second);
+      UnitsByName.erase(Unit.Name);
+      Units.erase(I);
+    }
+
+    if (Error Err = Unit.JD->remove(Unit.Symbols))
+      return Err;
+    for (std::shared_ptr<SectionMemoryManager> &MemMgr : Unit.MemMgrs)
+      MemMgr->deregisterEHFrames();
+    Unit.MemMgrs.clear();
+
+    std::lock_guard<std::mutex> Lock(UnitsMutex);
+    FreeDylibs.push_back(Unit.JD);
+    return Error::success();
   }
 
   Expected<JITEvaluatedSymbol> lookup(StringRef Name) {
     return ES.lookup({&ES.getMainJITDylib()}, Mangle(Name.str()));
   }
 
+  Expected<JITEvaluatedSymbol> lookup(orc::VModuleKey K, StringRef Name) {
+    orc::JITDylib *JD;
+    {
+      std::lock_guard<std::mutex> Lock(UnitsMutex);
+      auto I = Units.find(K);
+      assert(I != Units.end() && "Lookup in a released formula");
+      JD = I->second.JD;
+    }
+    return ES.lookup({JD}, Mangle(Name.str()));
+  }
+
 private:
-  static Expected<orc::ThreadSafeModule>
+  std::unique_ptr<RuntimeDyld::MemoryManager> createMemoryManager() {
+    std::lock_guard<std::mutex> Lock(UnitsMutex);
+    auto I = Units.find(MaterializingKey);
+    if (I == Units.end())
+      return llvm::make_unique<SectionMemoryManager>();
+    I->second.MemMgrs.push_back(std::make_shared<SectionMemoryManager>());
+    return llvm::make_unique<FormulaMemoryManager>(I->second.MemMgrs.back());
+  }
+
+  Expected<orc::ThreadSafeModule>
   optimizeModule(orc::ThreadSafeModule TSM,
                  const orc::MaterializationResponsibility &R) {
-    if (NoOpt)
+    MaterializingKey = R.getVModuleKey();
+
+    smt_jit::OptPipeline Selected =
+        NoOpt ? smt_jit::OptPipeline::None : Pipeline.getValue();
+    if (Selected == smt_jit::OptPipeline::Auto) {
+      Selected = smt_jit::selectOptPipeline(*TSM.getModule());
+      // The selection depends on the expected evaluations, which the formula
+      // hashes do not cover, so the cached objects are keyed on it too.
+      if (ObjCache)
+        TSM.getModule()->setModuleIdentifier(
+            TSM.getModule()->getModuleIdentifier() + "." +
+            smt_jit::getOptPipelineName(Selected).str());
+    }
+    LLVM_DEBUG(llvm::dbgs() << "Optimizing " << TSM.getModule()->getName()
+                            << " with the "
+                            << smt_jit::getOptPipelineName(Selected)
+                            << " pipeline\n");
+    smt_jit::setOptPipeline(*TSM.getModule(), Selected);
+
+    // Modules found in the object cache are not compiled at all.
+    if (Selected == smt_jit::OptPipeline::None ||
+        (ObjCache && ObjCache->hasObject(*TSM.getModule())))
       return TSM;
 
+    using namespace std::chrono;
+    const auto Start = steady_clock::now();
+
+    // Modules may be optimized concurrently, and TargetMachines are not
+    // thread-safe.
+    auto errTM = JTMB.createTargetMachine();
+    if (!errTM)
+      return errTM.takeError();
+    std::unique_ptr<TargetMachine> ModuleTM = std::move(*errTM);
+
+    // The formulas are emitted with their temp file paths as source names.
+    const std::string &TempPath = TSM.getModule()->getSourceFileName();
+
     legacy::PassManager PM;
     PM.add(createAlwaysInlinerLegacyPass());
     PM.run(*TSM.getModule());
 
     if (SaveTemps)
-      smt_jit::SaveIRToFile(*TSM.getModule(), {LastTempModulePath, ".inl.ll"});
+      smt_jit::SaveIRToFile(*TSM.getModule(), TempPath + ".inl.ll");
 
     legacy::FunctionPassManager FPM(TSM.getModule());
-    FPM.add(createInstructionCombiningPass());
-    FPM.add(createGVNPass());
-    FPM.add(createCFGSimplificationPass());
+    FPM.add(
+        createTargetTransformInfoWrapperPass(ModuleTM->getTargetIRAnalysis()));
+    smt_jit::addOptPipelinePasses(FPM, Selected,
+                                  /* vectorize = */ Lanes != 0);
     FPM.doInitialization();
 
     for (auto &F : *TSM.getModule())
@@ -162,21 +573,216 @@ private:
         FPM.run(F);
 
     if (SaveTemps)
-      smt_jit::SaveIRToFile(*TSM.getModule(), {LastTempModulePath, ".opt.ll"});
+      smt_jit::SaveIRToFile(*TSM.getModule(), TempPath + ".opt.ll");
 
+    ThreadCompilationTimers.Optimization +=
+        duration_cast<microseconds>(steady_clock::now() - Start);
     return TSM;
   }
+
+  Expected<std::unique_ptr<MemoryBuffer>> compileModule(Module &M) {
+    smt_jit::CodeGenConfig Config =
+        smt_jit::selectCodeGenConfig(smt_jit::getOptPipeline(M));
+    if (CodeGenOptLevel.getNumOccurrences() != 0)
+      Config.optLevel =
+          static_cast<CodeGenOpt::Level>(CodeGenOptLevel.getValue());
+    if (ISel.getNumOccurrences() != 0)
+      Config.isel = ISel;
+    LLVM_DEBUG(llvm::dbgs()
+               << "Generating code for " << M.getName() << " at -O"
+               << static_cast<unsigned>(Config.optLevel) << " with the "
+               << smt_jit::getInstructionSelectorName(Config.isel)
+               << " instruction selector\n");
+
+    using namespace std::chrono;
+    const auto Start = steady_clock::now();
+
+    // A TargetMachine per module, as in optimizeModule.
+    orc::JITTargetMachineBuilder ModuleJTMB = JTMB;
+    ModuleJTMB.setCodeGenOptLevel(Config.optLevel);
+    auto errTM = ModuleJTMB.createTargetMachine();
+    if (!errTM)
+      return errTM.takeError();
+    TargetMachine &ModuleTM = **errTM;
+
+    const bool Fast = Config.isel == smt_jit::InstructionSelector::Fast;
+    const bool Global = Config.isel == smt_jit::InstructionSelector::Global;
+    ModuleTM.setFastISel(Fast);
+    ModuleTM.setO0WantsFastISel(Fast);
+    ModuleTM.setGlobalISel(Global);
+    if (Global)
+      ModuleTM.setGlobalISelAbort(GlobalISelAbortMode::Disable);
+
+    auto Obj = orc::SimpleCompiler(ModuleTM, ObjCache)(M);
+    ThreadCompilationTimers.CodeGen +=
+        duration_cast<microseconds>(steady_clock::now() - Start);
+    return std::move(Obj);
+  }
 };
 
 void dummyFun() {}
 
 static bool doBVLibSanityCheck(SmtJit &jit);
 
-static int parseSmtAndEval(StringRef filename, Z3_context zCtx, SmtJit &jit,
-                           const llvm::Module &bvLibTemplate);
+using smt_jit::SmtBatchFunctionTy;
+using smt_jit::SmtFirstFunctionTy;
+using SmtLanesFunctionTy = unsigned (*)(bv_array **);
+
+// An LLVMContext to emit formulas in, with its own bvlib template. Formulas
+// compiled concurrently are emitted in separate contexts.
+struct FormulaContext {
+  orc::ThreadSafeContext TSCtx;
+  std::unique_ptr<Module> BVLibTemplate;
+};
+
+// The symbols of a formula added to the jit, and the key to look them up and
+// to release the formula with.
+struct AddedFormula {
+  smt_jit::FormulaSymbols Symbols;
+  orc::VModuleKey Key;
+  // Time spent emitting the formula module, without saving or adding it.
+  std::chrono::microseconds EmissionTime{0};
+};
+
+// The entry points of a formula added to the jit, and compiled by their
+// lookups.
+struct CompiledFormula {
+  std::unique_ptr<smt_jit::SmtLibParser> Parser;
+  smt_jit::FormulaEmitOptions EmitOptions;
+  orc::VModuleKey Key = 0;
+  SmtBatchFunctionTy BatchFn = nullptr;
+  SmtFirstFunctionTy FirstFn = nullptr;
+  SmtBatchFunctionTy DualBatchFn = nullptr;
+  SmtLanesFunctionTy LanesFn = nullptr;
+  std::vector<smt_jit::SmtAssertionFunctionTy> AssertionFns;
+  std::chrono::milliseconds CompilationTime;
+  // Parts of CompilationTime, which does not include parsing the input file,
+  // or saving and adding the emitted modules.
+  std::chrono::microseconds EmissionTime;
+  std::chrono::microseconds OptimizationTime;
+  std::chrono::microseconds CodeGenTime;
+};
+
+static std::unique_ptr<Module> loadBVLib(LLVMContext &ctx);
+
+static std::unique_ptr<FormulaContext> createFormulaContext();
+
+static std::unique_ptr<CompiledFormula>
+compileFormula(StringRef filename, SmtJit &jit, FormulaContext &formulaCtx,
+               FormulaContext &sharedCtx);
+
+static int
+parseSmtAndEval(StringRef filename, Z3_context zCtx, SmtJit &jit,
+                FormulaContext &ctx,
+                function_ref<std::unique_ptr<CompiledFormula>()> compile);
+
+// Compiles the input files in order, on Jobs threads with a formula context
+// each, while the main thread evaluates them. The compilation stays at most
+// Ahead files ahead of the evaluation, so that only a bounded number of
+// compiled formulas wait for it.
+class CompilationPipeline {
+  std::vector<std::string> Filenames;
+  std::vector<std::unique_ptr<FormulaContext>> Contexts;
+  std::vector<std::promise<std::unique_ptr<CompiledFormula>>> Promises;
+  std::vector<std::future<std::unique_ptr<CompiledFormula>>> Futures;
+  const size_t Ahead;
+
+  std::mutex Mutex;
+  std::condition_variable Advanced;
+  size_t NextFile = 0;
+  size_t EvaluatedFile = 0;
+  bool Stopped = false;
+  std::vector<std::thread> Workers;
+
+  // Returns the index of the next file to compile, once the evaluation is
+  // close enough, or None when there is nothing left to compile.
+  llvm::Optional<size_t> takeNextFile() {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Advanced.wait(Lock, [this] {
+      return Stopped || NextFile == Filenames.size() ||
+             NextFile <= EvaluatedFile + Ahead;
+    });
+    if (Stopped || NextFile == Filenames.size())
+      return llvm::None;
+    return NextFile++;
+  }
+
+public:
+  CompilationPipeline(std::vector<std::string> Files, size_t Ahead,
+                      SmtJit &Jit, FormulaContext &SharedCtx,
+                      std::vector<std::unique_ptr<FormulaContext>> Ctxs)
+      : Filenames(std::move(Files)), Contexts(std::move(Ctxs)),
+        Promises(Filenames.size()), Ahead(Ahead) {
+    for (auto &P : Promises)
+      Futures.push_back(P.get_future());
+
+    for (std::unique_ptr<FormulaContext> &Ctx : Contexts)
+      Workers.emplace_back([this, &Jit, &SharedCtx, &Ctx] {
+        while (llvm::Optional<size_t> I = takeNextFile()) {
+          // Missing files are reported and skipped by the evaluation.
+          std::unique_ptr<CompiledFormula> Compiled;
+          if (llvm::sys::fs::exists(Filenames[*I]))
+            Compiled = compileFormula(Filenames[*I], Jit, *Ctx, SharedCtx);
+          Promises[*I].set_value(std::move(Compiled));
+        }
+      });
+  }
+
+  ~CompilationPipeline() {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Stopped = true;
+    }
+    Advanced.notify_all();
+    for (std::thread &T : Workers)
+      T.join();
+  }
+
+  // Waits for the formula of the file, and lets the compilation advance past
+  // it. Returns nullptr if its compilation failed.
+  std::unique_ptr<CompiledFormula> get(size_t FileIdx) {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      EvaluatedFile = FileIdx;
+    }
+    Advanced.notify_all();
+    return Futures[FileIdx].get();
+  }
+};
+
+static int evalFirstModel(const smt_jit::SmtLibParser &parser,
+                          const smt_jit::AssignmentTable &table,
+                          SmtFirstFunctionTy smtFirstFunctionPtr);
+
+static int interpretSmt(smt_jit::SmtLibParser &parser);
+
+static int evalDual(const smt_jit::SmtLibParser &parser,
+                    smt_jit::AssignmentTable &table,
+                    SmtBatchFunctionTy smtDualBatchFunctionPtr);
+
+static int evalDelta(smt_jit::SmtLibParser &parser,
+                     const smt_jit::AssignmentTable &table,
+                     std::vector<smt_jit::SmtAssertionFunctionTy> assertionFns);
 
-static bool models(smt_jit::SmtLibParser &parser, unsigned assignmentIdx,
-                   int (*smtFunctionPtr)(bv_array **), bool verbose = false);
+static int evalMemo(smt_jit::SmtLibParser &parser,
+                    const smt_jit::AssignmentTable &table,
+                    std::vector<smt_jit::SmtAssertionFunctionTy> assertionFns);
+
+static void evalLanes(const smt_jit::AssignmentTable &table,
+                      ArrayRef<bv_array *> laneBlocks,
+                      SmtLanesFunctionTy smtLanesFunctionPtr,
+                      MutableArrayRef<int> results);
+
+static void evalModels(const smt_jit::SmtLibParser &parser,
+                       const smt_jit::AssignmentTable &table,
+                       function_ref<void(MutableArrayRef<int>)> evaluate);
+
+static void printTotalModels(const smt_jit::SmtLibParser &parser,
+                             size_t totalModels,
+                             std::chrono::steady_clock::time_point startTime);
+
+static void printBenchmarkTime(const smt_jit::SmtLibParser &parser,
+                               std::chrono::steady_clock::time_point startTime);
 
 static void error_handler(Z3_context c, Z3_error_code e) {
   llvm::errs() << "\nIncorrect use of Z3\nError code: " << e << "\n";
@@ -236,7 +842,11 @@ int main(int argc, char **argv) {
 
   llvm::outs() << "\nZ3 simple_example\n";
 
-  auto errJit = SmtJit::Create();
+  std::unique_ptr<smt_jit::FormulaObjectCache> objCache;
+  if (!CacheDir.empty())
+    objCache = llvm::make_unique<smt_jit::FormulaObjectCache>(CacheDir);
+
+  auto errJit = SmtJit::Create(objCache.get());
   if (!errJit) {
     llvm::errs() << "Could not create smt-jit: " << errJit.takeError() << "\n";
     return 2;
@@ -244,15 +854,25 @@ int main(int argc, char **argv) {
 
   std::unique_ptr<SmtJit> jit = std::move(errJit.get());
 
-  SMDiagnostic error;
-  const std::string bvlibBitcodePath = exeDir + "/bvlib/bvlib.ll";
-  std::unique_ptr<Module> m =
-      parseIRFile(bvlibBitcodePath, error, jit->getContext());
-  if (!m) {
-    llvm::errs() << "Could not load bitcode module: " << bvlibBitcodePath
-                 << "\nError: \n";
-    error.print(argv[0], llvm::errs());
+  std::unique_ptr<Module> m = loadBVLib(jit->getContext());
+  if (!m)
     return 1;
+  m->setSourceFileName(TempDir + "/bvlib");
+
+  if (objCache) {
+    const TargetMachine &TM = jit->getTargetMachine();
+    FormulaCacheEnvironment =
+        smt_jit::hashString(getBVLibBitcode()) + " " +
+        TM.getTargetTriple().str() + " " + TM.getTargetCPU().str() + " " +
+        TM.getTargetFeatureString().str() + " " +
+        smt_jit::getOptPipelineName(NoOpt ? smt_jit::OptPipeline::None
+                                          : Pipeline.getValue())
+            .str();
+    if (CodeGenOptLevel.getNumOccurrences() != 0)
+      FormulaCacheEnvironment += " O" + std::to_string(CodeGenOptLevel);
+    if (ISel.getNumOccurrences() != 0)
+      FormulaCacheEnvironment +=
+          " " + smt_jit::getInstructionSelectorName(ISel).str();
   }
 
   std::unique_ptr<Module> bvlibDeclsTemplate =
@@ -268,13 +888,108 @@ int main(int argc, char **argv) {
     return 2;
   }
 
-  for (const std::string &filename : InputFilenames) {
+  FormulaContext mainCtx;
+  mainCtx.TSCtx = jit->getThreadSafeContext();
+  mainCtx.BVLibTemplate = std::move(bvlibDeclsTemplate);
+
+  if (Lanes > smt_jit::FormulaEmitOptions::MaxLanes) {
+    llvm::errs() << "At most " << smt_jit::FormulaEmitOptions::MaxLanes
+                 << " lanes are supported\n";
+    return 1;
+  }
+
+  if (Threads > 1 && Lanes != 0) {
+    llvm::errs() << "Multi-threaded evaluation does not support --lanes\n";
+    return 1;
+  }
+
+  if (ReorderAfter != 0 && Lanes != 0) {
+    llvm::errs() << "--reorder-after does not support --lanes\n";
+    return 1;
+  }
+
+  if (Dual && (Threads > 1 || Lanes != 0 || FirstModel || ReorderAfter != 0)) {
+    llvm::errs() << "--dual does not support --threads, --lanes, "
+                    "--first-model, or --reorder-after\n";
+    return 1;
+  }
+
+  if (Engine == EngineKind::Interp &&
+      (Threads > 1 || Lanes != 0 || FirstModel || Dual || ReorderAfter != 0)) {
+    llvm::errs() << "--engine=interp does not support --threads, --lanes, "
+                    "--first-model, --dual, or --reorder-after\n";
+    return 1;
+  }
+
+  if (Delta && (Threads > 1 || Lanes != 0 || FirstModel || Dual ||
+                ReorderAfter != 0 || Engine == EngineKind::Interp)) {
+    llvm::errs() << "--delta does not support --threads, --lanes, "
+                    "--first-model, --dual, --reorder-after, or "
+                    "--engine=interp\n";
+    return 1;
+  }
+
+  if (MemoMinCost != 0 &&
+      (Threads > 1 || Lanes != 0 || FirstModel || Dual || Delta ||
+       ReorderAfter != 0 || Engine == EngineKind::Interp)) {
+    llvm::errs() << "--memo-min-cost does not support --threads, --lanes, "
+                    "--first-model, --dual, --delta, --reorder-after, or "
+                    "--engine=interp\n";
+    return 1;
+  }
+
+  if (FirstModel && (Threads > 1 || Lanes != 0)) {
+    llvm::errs() << "--first-model does not support --threads or --lanes\n";
+    return 1;
+  }
+
+  if (CodeGenOptLevel > 3) {
+    llvm::errs() << "--codegen-opt must be between 0 and 3\n";
+    return 1;
+  }
+
+  if (Jobs == 0) {
+    llvm::errs() << "--jobs must be at least 1\n";
+    return 1;
+  }
+
+  if ((Jobs > 1 || CompileAhead != 0) && Engine == EngineKind::Interp) {
+    llvm::errs() << "--jobs and --compile-ahead do not support "
+                    "--engine=interp\n";
+    return 1;
+  }
+
+  // The compilation jobs emit the formulas in their own contexts, and the
+  // shared assertions in the main one.
+  std::unique_ptr<CompilationPipeline> compiler;
+  if (Jobs > 1 || CompileAhead != 0) {
+    std::vector<std::unique_ptr<FormulaContext>> jobCtxs;
+    for (unsigned i = 0; i != Jobs; ++i) {
+      jobCtxs.push_back(createFormulaContext());
+      if (!jobCtxs.back())
+        return 2;
+    }
+
+    // Every job needs a file to compile.
+    const unsigned ahead = std::max<unsigned>(CompileAhead, Jobs);
+    compiler = llvm::make_unique<CompilationPipeline>(
+        std::vector<std::string>(InputFilenames.begin(), InputFilenames.end()),
+        ahead, *jit, mainCtx, std::move(jobCtxs));
+  }
+
+  for (size_t i = 0, e = InputFilenames.size(); i != e; ++i) {
+    const std::string &filename = InputFilenames[i];
     if (!llvm::sys::fs::exists(filename)) {
       llvm::errs() << "File " << filename << " does not exits\n";
       continue;
     }
 
-    const int res = parseSmtAndEval(filename, z3Ctx, *jit, *bvlibDeclsTemplate);
+    auto compile = [&]() -> std::unique_ptr<CompiledFormula> {
+      if (compiler)
+        return compiler->get(i);
+      return compileFormula(filename, *jit, mainCtx, mainCtx);
+    };
+    const int res = parseSmtAndEval(filename, z3Ctx, *jit, mainCtx, compile);
     llvm::outs().flush();
 
     if (res != 0) {
@@ -283,11 +998,261 @@ int main(int argc, char **argv) {
     }
   }
 
+  if ((ShareAssertions || LiftConstants) && BenchmarkMode)
+    llvm::outs() << "[SHARED] Assertions compiled "
+                 << jit->getNumSharedAssertions() << " / "
+                 << jit->getNumSharedAssertionUses() << "\n";
+
+  if (objCache && BenchmarkMode)
+    llvm::outs() << "[CACHE] Hits " << objCache->numHits() << ", misses "
+                 << objCache->numMisses() << "\n";
+
   return 0;
 }
 
+static StringRef getBVLibBitcode() {
+  return StringRef(reinterpret_cast<const char *>(BVLibBitcode),
+                   sizeof(BVLibBitcode));
+}
+
+std::unique_ptr<Module> loadBVLib(LLVMContext &ctx) {
+  auto errModule = getLazyBitcodeModule(
+      MemoryBufferRef(getBVLibBitcode(), "bvlib"), ctx);
+  if (!errModule) {
+    llvm::errs() << "Could not load the bvlib bitcode: "
+                 << errModule.takeError() << "\n";
+    return nullptr;
+  }
+
+  // Preparing the template needs the function bodies.
+  std::unique_ptr<Module> m = std::move(*errModule);
+  if (Error err = m->materializeAll()) {
+    llvm::errs() << "Could not load the bvlib bitcode: " << err << "\n";
+    return nullptr;
+  }
+
+  return m;
+}
+
+std::unique_ptr<FormulaContext> createFormulaContext() {
+  auto formulaCtx = llvm::make_unique<FormulaContext>();
+  formulaCtx->TSCtx = orc::ThreadSafeContext(llvm::make_unique<LLVMContext>());
+
+  std::unique_ptr<Module> bvlib = loadBVLib(*formulaCtx->TSCtx.getContext());
+  if (!bvlib)
+    return nullptr;
+
+  formulaCtx->BVLibTemplate = smt_jit::CloneDeclarationsAndPrepare(*bvlib);
+  if (!formulaCtx->BVLibTemplate) {
+    llvm::errs() << "Failed to create module template for jitted formulas!\n";
+    return nullptr;
+  }
+
+  return formulaCtx;
+}
+
+// Emits the formula in the formula context and adds it to the jit, together
+// with its new shared assertions, emitted in the shared context. The formula
+// stays in the jit until releaseFormula.
+static llvm::Optional<AddedFormula>
+addFormula(smt_jit::SmtLibParser &parser,
+           const smt_jit::FormulaEmitOptions &options,
+           const std::string &tempPath, SmtJit &jit, FormulaContext &formulaCtx,
+           FormulaContext &sharedCtx) {
+  // Cached formulas are named after their hashes, so that the names in the
+  // cached objects are the same in every run.
+  smt_jit::FormulaEmitOptions namedOptions = options;
+  if (jit.hasObjectCache())
+    namedOptions.name =
+        "smt_" + smt_jit::hashFormula(parser, options, FormulaCacheEnvironment);
+
+  // Other threads may be compiling the modules of the context. The context
+  // locks are never held while waiting for lockAdditions, and the
+  // ThreadSafeModules take them to destroy their modules.
+  orc::ThreadSafeModule formulaTSM;
+  smt_jit::FormulaSymbols symbols;
+  std::chrono::microseconds emissionTime;
+  {
+    auto formulaCtxLock = formulaCtx.TSCtx.getLock();
+    const auto emissionStart = std::chrono::steady_clock::now();
+    std::unique_ptr<llvm::Module> freshModule =
+        smt_jit::CreateFormulaModule(*formulaCtx.BVLibTemplate);
+    assert(freshModule);
+    freshModule->setSourceFileName(tempPath);
+    smt_jit::setExpectedEvaluations(
+        *freshModule, uint64_t(parser.numAssignments()) *
+                          (BenchmarkMode ? BenchmarkIterations : 1));
+    symbols = emitSmtFormula(parser, *freshModule, *formulaCtx.BVLibTemplate,
+                             namedOptions);
+    emissionTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - emissionStart);
+    if (SaveTemps)
+      smt_jit::SaveIRToFile(*freshModule, tempPath + ".ll");
+    formulaTSM =
+        orc::ThreadSafeModule(std::move(freshModule), formulaCtx.TSCtx);
+  }
+
+  auto additionsLock = jit.lockAdditions();
+  if (jit.hasObjectCache()) {
+    // The same formula may appear more than once in a run.
+    if (llvm::Optional<orc::VModuleKey> key =
+            jit.retainFormula(symbols.formula))
+      return AddedFormula{std::move(symbols), *key, emissionTime};
+    formulaTSM.getModule()->setModuleIdentifier(symbols.formula);
+  }
+
+  if (options.shareAssertions) {
+    // Only the assertions not seen in the previous formulas are compiled.
+    SmallVector<unsigned, 8> newAssertions;
+    for (size_t i = 0, e = symbols.sharedAssertions.size(); i != e; ++i)
+      if (jit.claimSharedAssertion(symbols.sharedAssertions[i]))
+        newAssertions.push_back(i);
+
+    if (!newAssertions.empty()) {
+      auto sharedCtxLock = sharedCtx.TSCtx.getLock();
+      const auto emissionStart = std::chrono::steady_clock::now();
+      std::unique_ptr<llvm::Module> sharedModule =
+          smt_jit::CreateFormulaModule(*sharedCtx.BVLibTemplate);
+      sharedModule->setSourceFileName(tempPath + ".shared");
+      smt_jit::emitSharedAssertions(parser, *sharedModule,
+                                    *sharedCtx.BVLibTemplate, newAssertions,
+                                    options.liftConstants);
+      emissionTime += std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - emissionStart);
+      if (jit.hasObjectCache()) {
+        // The same assertions may be shared again in later runs.
+        std::vector<std::string> newNames;
+        for (unsigned i : newAssertions)
+          newNames.push_back(symbols.sharedAssertions[i]);
+        sharedModule->setModuleIdentifier(
+            "smt_shared_" +
+            smt_jit::hashSharedAssertions(newNames, FormulaCacheEnvironment));
+      }
+      if (SaveTemps)
+        smt_jit::SaveIRToFile(*sharedModule, tempPath + ".shared.ll");
+
+      auto addSharedModule = jit.addSharedModule(
+          orc::ThreadSafeModule(std::move(sharedModule), sharedCtx.TSCtx));
+      if (addSharedModule) {
+        llvm::errs() << "Could not add a shared assertion module: "
+                     << addSharedModule << "\n";
+        return llvm::None;
+      }
+    }
+  }
+
+  auto errKey = jit.addFormulaModule(symbols.formula, std::move(formulaTSM));
+  if (!errKey) {
+    llvm::errs() << "Could not add a new smt module: " << errKey.takeError()
+                 << "\n";
+    return llvm::None;
+  }
+
+  return AddedFormula{std::move(symbols), *errKey, emissionTime};
+}
+
+static void releaseFormula(SmtJit &jit, orc::VModuleKey key) {
+  if (Error err = jit.releaseFormula(key))
+    llvm::errs() << "Could not release a formula: " << err << "\n";
+}
+
+static llvm::Optional<JITTargetAddress>
+lookupFunction(SmtJit &jit, orc::VModuleKey key, StringRef name) {
+  auto errLookup = jit.lookup(key, name);
+  if (!errLookup) {
+    llvm::errs() << "Lookup of the function " << name
+                 << " failed: " << errLookup.takeError() << "\n";
+    return llvm::None;
+  }
+
+  return errLookup->getAddress();
+}
+
+std::unique_ptr<CompiledFormula> compileFormula(StringRef filename,
+                                                SmtJit &jit,
+                                                FormulaContext &formulaCtx,
+                                                FormulaContext &sharedCtx) {
+  using namespace std::chrono;
+  const CompilationTimers timersStart = ThreadCompilationTimers;
+
+  auto compiled = llvm::make_unique<CompiledFormula>();
+  compiled->Parser = llvm::make_unique<smt_jit::SmtLibParser>(filename);
+  smt_jit::SmtLibParser &parser = *compiled->Parser;
+
+  smt_jit::FormulaEmitOptions &emitOptions = compiled->EmitOptions;
+  emitOptions.lanes = Lanes;
+  emitOptions.first = FirstModel;
+  emitOptions.dual = Dual;
+  emitOptions.assertionEntryPoints = Delta || MemoMinCost != 0;
+  emitOptions.shareAssertions = ShareAssertions || LiftConstants;
+  emitOptions.liftConstants = LiftConstants;
+  const std::string tempDest =
+      TempDir + "/" + llvm::sys::path::filename(filename).str();
+  const auto added =
+      addFormula(parser, emitOptions, tempDest, jit, formulaCtx, sharedCtx);
+  if (!added)
+    return nullptr;
+  const smt_jit::FormulaSymbols &smtSymbols = added->Symbols;
+  const orc::VModuleKey key = added->Key;
+  compiled->Key = key;
+  compiled->EmissionTime = added->EmissionTime;
+  // Failed lookups leave the formula in the jit; release it unless all the
+  // entry points resolve.
+  bool resolved = false;
+  auto _releaseOnFailure = smt_jit::OnScopeExit([&] {
+    if (!resolved)
+      releaseFormula(jit, key);
+  });
+
+  // The lookups compile the formula. Dual formulas only have the dual entry
+  // points.
+  if (Dual) {
+    auto smtDualBatchFnAddr = lookupFunction(jit, key, smtSymbols.dualBatch);
+    if (!smtDualBatchFnAddr.hasValue())
+      return nullptr;
+    compiled->DualBatchFn = (SmtBatchFunctionTy)smtDualBatchFnAddr.getValue();
+  } else {
+    auto smtBatchFnAddr = lookupFunction(jit, key, smtSymbols.batch);
+    if (!smtBatchFnAddr.hasValue())
+      return nullptr;
+    compiled->BatchFn = (SmtBatchFunctionTy)smtBatchFnAddr.getValue();
+  }
+
+  if (FirstModel) {
+    auto smtFirstFnAddr = lookupFunction(jit, key, smtSymbols.first);
+    if (!smtFirstFnAddr.hasValue())
+      return nullptr;
+    compiled->FirstFn = (SmtFirstFunctionTy)smtFirstFnAddr.getValue();
+  }
+
+  if (Lanes != 0) {
+    auto smtLanesFnAddr = lookupFunction(jit, key, smtSymbols.lanes);
+    if (!smtLanesFnAddr.hasValue())
+      return nullptr;
+    compiled->LanesFn = (SmtLanesFunctionTy)smtLanesFnAddr.getValue();
+  }
+
+  for (const std::string &name : smtSymbols.assertions) {
+    auto assertionFnAddr = lookupFunction(jit, key, name);
+    if (!assertionFnAddr.hasValue())
+      return nullptr;
+    compiled->AssertionFns.push_back(
+        (smt_jit::SmtAssertionFunctionTy)assertionFnAddr.getValue());
+  }
+
+  compiled->OptimizationTime =
+      ThreadCompilationTimers.Optimization - timersStart.Optimization;
+  compiled->CodeGenTime = ThreadCompilationTimers.CodeGen - timersStart.CodeGen;
+  compiled->CompilationTime = duration_cast<milliseconds>(
+      compiled->EmissionTime + compiled->OptimizationTime +
+      compiled->CodeGenTime);
+  resolved = true;
+  return compiled;
+}
+
 int parseSmtAndEval(StringRef filename, Z3_context zCtx, SmtJit &jit,
-                    const llvm::Module &bvLibTemplate) {
+                    FormulaContext &ctx,
+                    function_ref<std::unique_ptr<CompiledFormula>()> compile) {
   llvm::outs() << "Evaluating: " << filename << "\n";
   const StringRef tempBasename = llvm::sys::path::filename(filename);
   const std::string tempDest = TempDir + "/" + tempBasename.str();
@@ -297,137 +1262,368 @@ int parseSmtAndEval(StringRef filename, Z3_context zCtx, SmtJit &jit,
     smt_jit::ZSmtLibParser zparser(filename, zCtx);
     llvm::outs() << "\nAfer parsing " << filename << "\n";
   }
-  smt_jit::SmtLibParser parser(filename);
 
-  using namespace std::chrono;
-  const auto compilationStart = steady_clock::now();
-
-  std::unique_ptr<llvm::Module> freshModule =
-      smt_jit::CloneBVLibTemplate(bvLibTemplate);
-  assert(freshModule);
-
-  std::string smtFunctionName = emitSmtFormula(parser, *freshModule);
-  const auto compilationEnd = steady_clock::now();
-  if (BenchmarkMode) {
-    const auto ms =
-        duration_cast<milliseconds>(compilationEnd - compilationStart);
-    llvm::outs() << "[COMPILATION] Time " << ms.count() << " ms\n";
+  if (Engine == EngineKind::Interp) {
+    smt_jit::SmtLibParser parser(filename);
+    return interpretSmt(parser);
   }
 
-  if (SaveTemps) {
-    LastTempModulePath = tempDest;
-    smt_jit::SaveIRToFile(*freshModule, tempDest + ".ll");
-  }
+  using namespace std::chrono;
 
-  auto addSmtModule = jit.addModule(std::move(freshModule));
-  if (addSmtModule) {
-    llvm::errs() << "Could not add a new smt module: " << addSmtModule << "\n";
+  std::unique_ptr<CompiledFormula> compiled = compile();
+  if (!compiled)
     return 2;
-  }
+
+  // The code of the formula is freed once it is evaluated.
+  llvm::Optional<orc::VModuleKey> reorderedKey;
+  auto _releaseFormulas = smt_jit::OnScopeExit([&] {
+    releaseFormula(jit, compiled->Key);
+    if (reorderedKey)
+      releaseFormula(jit, *reorderedKey);
+  });
+  smt_jit::SmtLibParser &parser = *compiled->Parser;
+  smt_jit::FormulaEmitOptions &emitOptions = compiled->EmitOptions;
+
+  if (BenchmarkMode)
+    llvm::outs() << "[COMPILATION] Time " << compiled->CompilationTime.count()
+                 << " ms (emission " << compiled->EmissionTime.count()
+                 << " us, optimization " << compiled->OptimizationTime.count()
+                 << " us, codegen " << compiled->CodeGenTime.count()
+                 << " us)\n";
 
   LLVM_DEBUG(if (!doBVLibSanityCheck(jit)) {
     llvm::errs() << "Sanity check failed, aborting.\n";
     return 2;
   });
 
-  auto lookupFunctionOrNone =
-      [&jit](StringRef name) -> llvm::Optional<JITTargetAddress> {
-    auto errLookup = jit.lookup(name);
-    if (!errLookup) {
-      llvm::errs() << "Lookup of the function " << name
-                   << " failed: " << errLookup.takeError() << "\n";
-      return llvm::None;
+  SmtBatchFunctionTy smtBatchFunctionPtr = compiled->BatchFn;
+  SmtFirstFunctionTy smtFirstFunctionPtr = compiled->FirstFn;
+  SmtBatchFunctionTy smtDualBatchFunctionPtr = compiled->DualBatchFn;
+  SmtLanesFunctionTy smtLanesFunctionPtr = compiled->LanesFn;
+  std::vector<smt_jit::SmtAssertionFunctionTy> assertionFunctionPtrs =
+      std::move(compiled->AssertionFns);
+  llvm::outs().flush();
+
+  // Every query gets a fresh bvlib context for its arrays.
+  bv_context *bvCtx = bv_context_create();
+  auto _destroyBVCtx =
+      smt_jit::OnScopeExit([bvCtx] { bv_context_destroy(bvCtx); });
+
+  // Convert the assignments to bvlib arrays once; the evaluation loops below
+  // only pass the prepared array packs around. With multiple threads, every
+  // worker marshals its own table, and the one of the first worker stands in
+  // for the table of the query.
+  llvm::Optional<smt_jit::ParallelEvaluator> parallelEvaluator;
+  llvm::Optional<smt_jit::AssignmentTable> ownTable;
+  if (Threads > 1)
+    parallelEvaluator.emplace(parser, Threads);
+  else
+    ownTable.emplace(parser, bvCtx);
+  smt_jit::AssignmentTable &table =
+      parallelEvaluator ? parallelEvaluator->getTable() : *ownTable;
+  std::vector<int> results(table.size());
+  std::vector<bv_array *> laneBlocks;
+  if (smtLanesFunctionPtr)
+    laneBlocks = table.makeLaneBlocks(Lanes);
+
+  if (ReorderAfter != 0 && parser.numAssertions() > 1 && !table.empty()) {
+    // Profile the formula on the first assignments and recompile it with the
+    // assertions that reject most assignments (cheaply) checked first.
+    const auto reorderStart = steady_clock::now();
+    const size_t numSamples = std::min<size_t>(ReorderAfter, table.size());
+    smtBatchFunctionPtr(table.packs(), numSamples, results.data());
+
+    smt_jit::AssertionProfile profile(parser.numAssertions());
+    profile.record(makeArrayRef(results).take_front(numSamples));
+    emitOptions.assertionOrder =
+        profile.computeOrder(smt_jit::estimateAssertionCosts(parser));
+
+    const auto reordered = addFormula(parser, emitOptions,
+                                      tempDest + ".reordered", jit, ctx, ctx);
+    if (!reordered)
+      return 2;
+    reorderedKey = reordered->Key;
+
+    auto reorderedBatchFnAddr =
+        lookupFunction(jit, reordered->Key, reordered->Symbols.batch);
+    if (!reorderedBatchFnAddr.hasValue())
+      return 2;
+    smtBatchFunctionPtr = (SmtBatchFunctionTy)reorderedBatchFnAddr.getValue();
+
+    if (FirstModel) {
+      auto reorderedFirstFnAddr =
+          lookupFunction(jit, reordered->Key, reordered->Symbols.first);
+      if (!reorderedFirstFnAddr.hasValue())
+        return 2;
+      smtFirstFunctionPtr =
+          (SmtFirstFunctionTy)reorderedFirstFnAddr.getValue();
     }
 
-    return errLookup->getAddress();
-  };
+    if (BenchmarkMode) {
+      const auto ms =
+          duration_cast<milliseconds>(steady_clock::now() - reorderStart);
+      llvm::outs() << "[REORDER] Time " << ms.count() << " ms, order:";
+      for (unsigned i : emitOptions.assertionOrder)
+        llvm::outs() << " " << (i + 1);
+      llvm::outs() << "\n";
+    }
+  }
 
-  auto smtFnAddr = lookupFunctionOrNone(smtFunctionName);
-  if (!smtFnAddr.hasValue())
-    return 2;
+  if (smtFirstFunctionPtr)
+    return evalFirstModel(parser, table, smtFirstFunctionPtr);
 
-  auto *smtFunctionPtr = (int (*)(bv_array **))smtFnAddr.getValue();
-  llvm::outs().flush();
+  if (smtDualBatchFunctionPtr)
+    return evalDual(parser, table, smtDualBatchFunctionPtr);
 
-  bv_init_context();
-  if (!BenchmarkMode) {
-    llvm::outs() << "Formula modeled by assignments: ";
-    for (size_t assignmentIdx = 0, e = parser.numAssignments();
-         assignmentIdx != e; ++assignmentIdx) {
-      const bool res = models(parser, assignmentIdx, smtFunctionPtr, false);
-      if (res)
-        llvm::outs() << assignmentIdx << ", ";
-    }
-    llvm::outs() << "\n";
-  } else {
+  if (Delta)
+    return evalDelta(parser, table, std::move(assertionFunctionPtrs));
+
+  if (MemoMinCost != 0)
+    return evalMemo(parser, table, std::move(assertionFunctionPtrs));
+
+  if (parallelEvaluator && BenchmarkMode) {
+    // The workers run all the iterations without waiting for each other.
     const auto startTime = steady_clock::now();
+    const size_t totalModels =
+        parallelEvaluator->evaluate(smtBatchFunctionPtr, BenchmarkIterations);
+    printTotalModels(parser, totalModels, startTime);
+    return 0;
+  }
+
+  evalModels(parser, table, [&](MutableArrayRef<int> packResults) {
+    if (parallelEvaluator)
+      parallelEvaluator->evaluate(smtBatchFunctionPtr, 1, packResults);
+    else if (smtLanesFunctionPtr)
+      evalLanes(table, laneBlocks, smtLanesFunctionPtr, packResults);
+    else
+      smtBatchFunctionPtr(table.packs(), table.size(), packResults.data());
+  });
+  return 0;
+}
+
+int evalFirstModel(const smt_jit::SmtLibParser &parser,
+                   const smt_jit::AssignmentTable &table,
+                   SmtFirstFunctionTy smtFirstFunctionPtr) {
+  using namespace std::chrono;
+
+  if (!BenchmarkMode) {
+    const auto firstModel =
+        smt_jit::findFirstModel(table, smtFirstFunctionPtr);
+    llvm::outs() << "First model: ";
+    if (firstModel)
+      llvm::outs() << *firstModel << "\n";
+    else
+      llvm::outs() << "none\n";
+    return 0;
+  }
+
+  // Measure the time to the first model.
+  const auto startTime = steady_clock::now();
+
+  size_t totalModels = 0;
+  for (unsigned iter = 0, e = BenchmarkIterations; iter != e; ++iter)
+    if (smt_jit::findFirstModel(table, smtFirstFunctionPtr))
+      ++totalModels;
+
+  llvm::outs() << "First models: " << totalModels << " / "
+               << BenchmarkIterations << " iterations\n";
+  printBenchmarkTime(parser, startTime);
+  return 0;
+}
+
+int interpretSmt(smt_jit::SmtLibParser &parser) {
+  using namespace std::chrono;
+
+  const auto compilationStart = steady_clock::now();
+  smt_jit::BytecodeProgram program(parser);
+  const auto compilationEnd = steady_clock::now();
+  if (BenchmarkMode) {
+    const auto ms =
+        duration_cast<milliseconds>(compilationEnd - compilationStart);
+    llvm::outs() << "[COMPILATION] Time " << ms.count() << " ms ("
+                 << program.size() << " instructions)\n";
+  }
+  LLVM_DEBUG(program.dump());
+
+  bv_context *bvCtx = bv_context_create();
+  auto _destroyBVCtx =
+      smt_jit::OnScopeExit([bvCtx] { bv_context_destroy(bvCtx); });
+
+  smt_jit::AssignmentTable table(parser, bvCtx);
+  smt_jit::BytecodeInterpreter interpreter(program);
+  evalModels(parser, table, [&](MutableArrayRef<int> results) {
+    interpreter.evaluate(table, results);
+  });
+  return 0;
+}
+
+int evalDual(const smt_jit::SmtLibParser &parser,
+             smt_jit::AssignmentTable &table,
+             SmtBatchFunctionTy smtDualBatchFunctionPtr) {
+  using namespace std::chrono;
+  using smt_jit::DualConstraintsHold;
+  using smt_jit::DualExprTrue;
 
-    size_t totalModels = 0;
-    for (unsigned iter = 0, e = BenchmarkIterations; iter != e; ++iter) {
-      for (size_t assignmentIdx = 0, e = parser.numAssignments();
-           assignmentIdx != e; ++assignmentIdx)
-        totalModels += models(parser, assignmentIdx, smtFunctionPtr, false);
+  std::vector<int> results(table.size());
 
-      bv_reset_context();
+  if (!BenchmarkMode) {
+    smtDualBatchFunctionPtr(table.packs(), table.size(), results.data());
+
+    SmallVector<size_t, 16> exprTrue;
+    SmallVector<size_t, 16> exprFalse;
+    for (size_t i = 0, e = results.size(); i != e; ++i) {
+      if (!(results[i] & DualConstraintsHold))
+        continue;
+      if (results[i] & DualExprTrue)
+        exprTrue.push_back(i);
+      else
+        exprFalse.push_back(i);
     }
 
-    const auto endTime = steady_clock::now();
-    const auto ms = duration_cast<milliseconds>(endTime - startTime);
+    llvm::outs() << "Expression true under constraints for assignments: ";
+    for (size_t i : exprTrue)
+      llvm::outs() << table.getAssignmentIdx(i) << ", ";
+    llvm::outs() << "\nExpression false under constraints for assignments: ";
+    for (size_t i : exprFalse)
+      llvm::outs() << table.getAssignmentIdx(i) << ", ";
+    llvm::outs() << "\n";
+    return 0;
+  }
 
-    llvm::outs() << "Total models: " << totalModels << " / "
-                 << BenchmarkIterations << " iterations\n";
-    llvm::outs() << "[BENCHMARK] Time " << ms.count() << " ms klee "
-                 << parser.getKleeTime() << "\n";
+  const auto startTime = steady_clock::now();
+
+  size_t totalTrue = 0;
+  size_t totalFalse = 0;
+  for (unsigned iter = 0, e = BenchmarkIterations; iter != e; ++iter) {
+    smtDualBatchFunctionPtr(table.packs(), table.size(), results.data());
+    for (int res : results) {
+      if (!(res & DualConstraintsHold))
+        continue;
+      if (res & DualExprTrue)
+        ++totalTrue;
+      else
+        ++totalFalse;
+    }
   }
-  bv_reset_context();
 
+  llvm::outs() << "Total models: " << totalTrue << " (expr true), "
+               << totalFalse << " (expr false) / " << BenchmarkIterations
+               << " iterations\n";
+  printBenchmarkTime(parser, startTime);
   return 0;
 }
 
-bool models(smt_jit::SmtLibParser &parser, unsigned assignmentIdx,
-            int (*smtFunctionPtr)(bv_array **), bool verbose /* = false */) {
-  smt_jit::Assignment &assignment = parser.assignments()[assignmentIdx];
-  const size_t numArrays = parser.numArrays();
+// Prints the assignments that model the formula, or, in benchmark mode, the
+// number of models found by BenchmarkIterations evaluations and their time.
+// `evaluate` stores the result of every pack of the table, 0 for the models.
+void evalModels(const smt_jit::SmtLibParser &parser,
+                const smt_jit::AssignmentTable &table,
+                function_ref<void(MutableArrayRef<int>)> evaluate) {
+  using namespace std::chrono;
 
-  if (verbose)
-    llvm::outs() << "Assignment " << assignmentIdx << ": ";
+  std::vector<int> results(table.size());
 
-  if (assignment.numVariables() != numArrays) {
-    if (verbose)
-      llvm::outs() << "wrong number of variables (" << assignment.numVariables()
-                   << " vs. " << numArrays << ")\n";
-    return false;
+  if (!BenchmarkMode) {
+    evaluate(results);
+
+    llvm::outs() << "Formula modeled by assignments: ";
+    for (size_t i = 0, e = results.size(); i != e; ++i)
+      if (results[i] == 0)
+        llvm::outs() << table.getAssignmentIdx(i) << ", ";
+    llvm::outs() << "\n";
+    return;
   }
 
-  SmallVector<bv_array *, 2> varToArray;
+  const auto startTime = steady_clock::now();
 
-  for (const smt_jit::ArrayInfo &ai : parser.arrays()) {
-    using AssignmentVector = smt_jit::Assignment::AssignmentVector;
+  size_t totalModels = 0;
+  for (unsigned iter = 0, e = BenchmarkIterations; iter != e; ++iter) {
+    evaluate(results);
+    totalModels += std::count(results.begin(), results.end(), 0);
+  }
 
-    if (!assignment.hasVariable(ai.name)) {
-      if (verbose)
-        llvm::outs() << "partial assignment, " << ai.name << " missing\n";
-      return false;
-    }
+  printTotalModels(parser, totalModels, startTime);
+}
+
+void printTotalModels(const smt_jit::SmtLibParser &parser, size_t totalModels,
+                      std::chrono::steady_clock::time_point startTime) {
+  llvm::outs() << "Total models: " << totalModels << " / "
+               << BenchmarkIterations << " iterations\n";
+  printBenchmarkTime(parser, startTime);
+}
+
+// Prints the time since the start of the benchmark iterations.
+void printBenchmarkTime(const smt_jit::SmtLibParser &parser,
+                        std::chrono::steady_clock::time_point startTime) {
+  using namespace std::chrono;
+  const auto ms = duration_cast<milliseconds>(steady_clock::now() - startTime);
+  llvm::outs() << "[BENCHMARK] Time " << ms.count() << " ms klee "
+               << parser.getKleeTime() << "\n";
+}
 
-    AssignmentVector &arr = assignment.getValue(ai.name);
-    bv_array *bv_arr = bva_mk_init(ai.element_width, arr.size(), arr.data());
-    varToArray.push_back(bv_arr);
+int evalDelta(smt_jit::SmtLibParser &parser,
+              const smt_jit::AssignmentTable &table,
+              std::vector<smt_jit::SmtAssertionFunctionTy> assertionFns) {
+  using namespace std::chrono;
+
+  const auto analysisStart = steady_clock::now();
+  smt_jit::DeltaEvaluator evaluator(parser, table, std::move(assertionFns));
+  if (BenchmarkMode) {
+    const auto ms =
+        duration_cast<milliseconds>(steady_clock::now() - analysisStart);
+    llvm::outs() << "[DELTA] Analysis time " << ms.count() << " ms\n";
   }
 
-  assert(varToArray.size() == numArrays);
+  evalModels(parser, table, [&](MutableArrayRef<int> results) {
+    evaluator.evaluate(results);
+  });
+  if (BenchmarkMode)
+    llvm::outs() << "[DELTA] Assertions evaluated: "
+                 << evaluator.numEvaluated()
+                 << ", reused: " << evaluator.numReused() << "\n";
+  return 0;
+}
 
-  int res = smtFunctionPtr(varToArray.data());
-  if (res == 0) {
-    if (verbose)
-      llvm::outs() << "models\n";
-    return true;
+int evalMemo(smt_jit::SmtLibParser &parser,
+             const smt_jit::AssignmentTable &table,
+             std::vector<smt_jit::SmtAssertionFunctionTy> assertionFns) {
+  using namespace std::chrono;
+
+  const auto projectionStart = steady_clock::now();
+  smt_jit::MemoEvaluator evaluator(parser, table, std::move(assertionFns),
+                                   MemoMinCost);
+  if (BenchmarkMode) {
+    const auto ms =
+        duration_cast<milliseconds>(steady_clock::now() - projectionStart);
+    llvm::outs() << "[MEMO] Projection time " << ms.count() << " ms, "
+                 << evaluator.numCachedAssertions() << " / "
+                 << parser.numAssertions() << " assertions cached\n";
   }
 
-  if (verbose)
-    llvm::outs() << "assertion " << res << " failed\n";
+  evalModels(parser, table, [&](MutableArrayRef<int> results) {
+    evaluator.evaluate(results);
+  });
+  if (BenchmarkMode)
+    llvm::outs() << "[MEMO] Cache hits: " << evaluator.numHits()
+                 << ", misses: " << evaluator.numMisses() << "\n";
+  return 0;
+}
 
-  return false;
+void evalLanes(const smt_jit::AssignmentTable &table,
+               ArrayRef<bv_array *> laneBlocks,
+               SmtLanesFunctionTy smtLanesFunctionPtr,
+               MutableArrayRef<int> results) {
+  assert(results.size() == table.size());
+  const size_t blockSize = table.numArrays() * Lanes;
+  for (size_t b = 0, e = table.numLaneBlocks(Lanes); b != e; ++b) {
+    const unsigned mask = smtLanesFunctionPtr(
+        const_cast<bv_array **>(laneBlocks.data()) + b * blockSize);
+    // Drop the padding lanes of the last block. The lanes variant does not
+    // tell which assertion failed, so the other assignments get 1.
+    const size_t validLanes = std::min<size_t>(Lanes, table.size() - b * Lanes);
+    for (unsigned l = 0; l != validLanes; ++l)
+      results[b * Lanes + l] = (mask & (1u << l)) ? 0 : 1;
+  }
 }
 
 bool doBVLibSanityCheck(SmtJit &jit) {
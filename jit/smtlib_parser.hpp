@@ -57,6 +57,10 @@ struct ArrayInfo {
   unsigned element_width;
   bool is_bitvector;
   std::string name;
+
+  // Arrays of elements up to 64 bits are evaluated as bvlib packed arrays
+  // (bv_packed_array), and the wider ones as regular bitvector arrays.
+  bool isPacked() const { return is_bitvector && element_width <= 64; }
 };
 
 class ZSmtLibParser {
@@ -7,6 +7,7 @@
 #include "llvm/ADT/Twine.h"
 
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
@@ -15,9 +16,12 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "bvlib_cloner.hpp"
+#include "canonical_assertion.hpp"
 #include "smtlib_parser.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <memory>
 
@@ -31,7 +35,11 @@ namespace {
 class Smt2LLVM {
   LLVMContext &m_ctx;
   Module &m_module;
+  // Template the bvlib functions are imported from; see ImportBVLibFunction.
+  const Module &m_bvLib;
   SmtLibParser &m_parser;
+  // Shared assertions take their bitvector literals from a constant table.
+  bool m_liftConstants;
 
   std::unique_ptr<IRBuilder<>> m_builder = nullptr;
 
@@ -39,6 +47,8 @@ class Smt2LLVM {
   StructType *m_i64PairTy = nullptr;
   StructType *m_bvaTy = nullptr;
   PointerType *m_bvaPtrTy = nullptr;
+  StructType *m_bvpaTy = nullptr;
+  PointerType *m_bvpaPtrTy = nullptr;
 
   IntegerType *m_i32Ty = nullptr;
   IntegerType *m_i64Ty = nullptr;
@@ -47,76 +57,213 @@ class Smt2LLVM {
   ConstantInt *m_i32Zero = nullptr;
   ConstantInt *m_i32One = nullptr;
 
-  Function *m_bvPrintFn = nullptr;
-  Function *m_bvaPrintFn = nullptr;
+  // Attributes of the generated functions, same as of the bvlib functions.
+  AttributeList m_fnAttrs;
 
-  Function *m_bvMkFn = nullptr;
-  Function *m_bvAddFn = nullptr;
-  Function *m_bvMulFn = nullptr;
-  Function *m_bvAndFn = nullptr;
-  Function *m_bvOrFn = nullptr;
-  Function *m_bvConcatFn = nullptr;
+  SmallVector<Function *, 8> m_assertFns;
+  // Arrays passed to the assertion being lowered, in the argument order.
+  SmallVector<unsigned, 4> m_argArrayIdxs;
 
-  Function *m_bvEqFn = nullptr;
-  Function *m_bvULTFn = nullptr;
-  Function *m_bvSLTFn = nullptr;
+  // Bitvectors up to this wide are lowered to native integers.
+  static constexpr unsigned MaxNativeWidth = 64;
 
-  Function *m_bvExtractFn = nullptr;
-  Function *m_bvZExtFn = nullptr;
-  Function *m_bvSExtFn = nullptr;
+  // Value on the lowering stack. Bitvectors of at most MaxNativeWidth bits are
+  // native integers holding bitvector_t::bits. They follow the bvlib semantics,
+  // so the integer type can be wider than the bitvector (e.g., after a
+  // zero_extend to a smaller width). Wider bitvectors are bvlib bitvectors
+  // ({i64, i64}).
+  struct LoweredValue {
+    Value *val = nullptr;
+    // Width of bitvectors; 0 for booleans, integer parameters, and arrays.
+    unsigned width = 0;
 
-  Function *m_bvaSelectFn = nullptr;
+    bool isBitVector() const { return width != 0; }
+    bool isNative() const { return isBitVector() && width <= MaxNativeWidth; }
+  };
 
 public:
-  Smt2LLVM(SmtLibParser &parser, llvm::Module &M);
+  Smt2LLVM(SmtLibParser &parser, llvm::Module &M, const llvm::Module &bvLib,
+           bool liftConstants = false);
+
+  void lowerAssertions(const Twine &funName,
+                       std::vector<std::string> *sharedNames = nullptr);
+  Function *emitFormula(const Twine &funName, ArrayRef<unsigned> order = {});
+  Function *emitBatchFormula(Function *formula, const Twine &name);
+  Function *emitFirstModelFormula(Function *formula, const Twine &name);
+  Function *emitLanesFormula(unsigned lanes, const Twine &name);
+  Function *emitDualFormula(const Twine &name);
 
-  void emitFormula(const Twine &funName);
+  void emitAssertionEntryPoints(ArrayRef<std::string> names);
+  Function *emitSharedAssertion(unsigned idx);
 
 private:
   std::pair<Function *, StringMap<Argument *>>
-  emitFunctionOverBVArrays(const Twine &name);
-
-  Function *lowerAssert(unsigned idx, const Twine &name);
+  emitFunctionOverBVArrays(const Twine &name, ArrayRef<unsigned> arrayIdxs,
+                           bool constantTable = false);
+  void loadArrays(IRBuilder<> &builder, Value *arrPack,
+                  SmallVectorImpl<Value *> &arrays);
+
+  Function *lowerAssert(unsigned idx, const Twine &name,
+                        ArrayRef<unsigned> arrayIdxs,
+                        bool liftConstants = false);
+  Function *emitSharedAssertionCall(unsigned idx, const Twine &name,
+                                    const CanonicalAssertion &canonical);
   Value *lowerIntegerConstant(long long val);
   std::pair<Value *, Value *> unpackI64Pair(Value *valPair);
-  Value *lowerBVMk(Value *constant, Value *width, const Twine &name = "bv");
-  Value *lowerCmp(Value *lhs, Value *rhs, const Twine &name = "cmp");
+  Value *getBits(const LoweredValue &bv, IntegerType *ty);
+  Value *packBitVector(Value *bits, unsigned width);
+  Value *toBitVector(const LoweredValue &bv);
+  LoweredValue fromBitVector(Value *bv, unsigned width);
+  LoweredValue lowerBVMk(Value *constant, unsigned width,
+                         const Twine &name = "bv");
+  Value *lowerCmp(const LoweredValue &lhs, const LoweredValue &rhs,
+                  const Twine &name = "cmp");
   Value *lowerAnd(Value *lhs, Value *rhs, const Twine &name = "and");
   Value *lowerOr(Value *lhs, Value *rhs, const Twine &name = "and");
+  LoweredValue lowerBinaryOp(const LoweredValue &lhs, const LoweredValue &rhs,
+                             Instruction::BinaryOps op, StringRef bvFnName,
+                             const Twine &name = "binop");
   Value *lowerBvBinaryFn(Value *lhs, Value *rhs, Function *op,
                          const Twine &name = "binop");
-  Value *lowerEq(Value *lhs, Value *rhs, const Twine &name = "eq");
-  Value *lowerLessThan(Value *lhs, Value *rhs, bool isSigned,
-                       const Twine &name = "lt");
-  Value *lowerExtract(Value *bv, Value *from, Value *to,
-                      const Twine &name = "extr");
-  Value *lowerZExt(Value *val, Value *width, const Twine &name = "zext");
-  Value *lowerSExt(Value *val, Value *width, const Twine &name = "sext");
-  Value *lowerSelect(Value *array, Value *index, const Twine &name = "select");
+  Value *lowerLessThan(const LoweredValue &lhs, const LoweredValue &rhs,
+                       bool isSigned, const Twine &name = "lt");
+  LoweredValue lowerConcat(const LoweredValue &lhs, const LoweredValue &rhs,
+                           const Twine &name = "concat");
+  LoweredValue lowerExtract(const LoweredValue &bv, unsigned from, unsigned to,
+                            const Twine &name = "extr");
+  LoweredValue lowerZExt(const LoweredValue &bv, unsigned width,
+                         const Twine &name = "zext");
+  LoweredValue lowerSExt(const LoweredValue &bv, unsigned width,
+                         const Twine &name = "sext");
+  LoweredValue lowerSelect(Argument *array, const LoweredValue &index,
+                           const Twine &name = "select");
+  LoweredValue lowerPackedSelect(Argument *array, const LoweredValue &index,
+                                 const Twine &name = "select");
+
+  Function *getBVLibFunction(StringRef name) {
+    Function *func = ImportBVLibFunction(m_bvLib, m_module, name);
+    assert(func && "Not a bvlib function");
+    return func;
+  }
+
+  IntegerType *getIntTy(unsigned bits) const {
+    return IntegerType::get(m_ctx, bits);
+  }
+
+  // Width of the integer type holding the bits.
+  static unsigned getNumBits(const LoweredValue &bv) {
+    assert(bv.isBitVector());
+    return bv.isNative() ? bv.val->getType()->getIntegerBitWidth() : 64;
+  }
+
+  static unsigned getIntegerParam(const LoweredValue &param) {
+    assert(!param.isBitVector());
+    return cast<ConstantInt>(param.val)->getZExtValue();
+  }
+
+  // Arrays passed to the assertions are arguments of the assertion functions.
+  const ArrayInfo &getArgArray(Argument *array) const {
+    return m_parser.arrays()[m_argArrayIdxs[array->getArgNo()]];
+  }
+
+  PointerType *getArrayPtrTy(const ArrayInfo &ai) const {
+    return ai.isPacked() ? m_bvpaPtrTy : m_bvaPtrTy;
+  }
+
+  SmallVector<unsigned, 4> getAllArrayIdxs() const {
+    SmallVector<unsigned, 4> res;
+    for (unsigned i = 0, e = m_parser.numArrays(); i != e; ++i)
+      res.push_back(i);
+    return res;
+  }
+
+  CanonicalAssertion canonicalize(unsigned idx) const {
+    return canonicalizeAssertion(m_parser.assertions()[idx], m_parser.arrays(),
+                                 m_liftConstants);
+  }
+
+  std::string getSharedAssertionName(const CanonicalAssertion &c) const {
+    return (m_liftConstants ? "smt_shape_" : "smt_assert_") + c.hash;
+  }
 };
 } // namespace
 
-std::string emitSmtFormula(smt_jit::SmtLibParser &parser, llvm::Module &M) {
-  static unsigned cnt = 0;
-  std::string num = std::to_string(cnt++);
-  std::string name = "smt_" + num;
+FormulaSymbols emitSmtFormula(smt_jit::SmtLibParser &parser, llvm::Module &M,
+                              const llvm::Module &bvLib,
+                              const FormulaEmitOptions &options) {
+  // Formulas may be emitted concurrently.
+  static std::atomic<unsigned> cnt(0);
+  FormulaSymbols symbols;
+  symbols.formula =
+      options.name.empty() ? "smt_" + std::to_string(cnt++) : options.name;
+
+  assert(!options.liftConstants || options.shareAssertions);
+  Smt2LLVM smt2llvm(parser, M, bvLib, options.liftConstants);
+  std::vector<std::string> *sharedNames =
+      options.shareAssertions ? &symbols.sharedAssertions : nullptr;
+  smt2llvm.lowerAssertions(symbols.formula, sharedNames);
+
+  // Dual queries are only evaluated through the dual variant.
+  assert(!(options.dual && options.first));
+  if (options.dual) {
+    assert(parser.numAssertions() > 0 && "No query expression");
+    symbols.dual = symbols.formula + "_dual";
+    symbols.dualBatch = symbols.dual + "_batch";
+    Function *dual = smt2llvm.emitDualFormula(symbols.dual);
+    smt2llvm.emitBatchFormula(dual, symbols.dualBatch);
+  } else {
+    symbols.batch = symbols.formula + "_batch";
+    Function *formula =
+        smt2llvm.emitFormula(symbols.formula, options.assertionOrder);
+    smt2llvm.emitBatchFormula(formula, symbols.batch);
+    if (options.first) {
+      symbols.first = symbols.formula + "_first";
+      smt2llvm.emitFirstModelFormula(formula, symbols.first);
+    }
+  }
+
+  if (options.lanes != 0) {
+    assert(options.lanes <= FormulaEmitOptions::MaxLanes);
+    symbols.lanes = symbols.formula + "_lanes";
+    smt2llvm.emitLanesFormula(options.lanes, symbols.lanes);
+  }
 
-  Smt2LLVM smt2llvm(parser, M);
-  smt2llvm.emitFormula(name);
+  if (options.assertionEntryPoints) {
+    for (size_t i = 0, e = parser.numAssertions(); i != e; ++i)
+      symbols.assertions.push_back(symbols.formula + "_check_" +
+                                   std::to_string(i + 1));
+    smt2llvm.emitAssertionEntryPoints(symbols.assertions);
+  }
+
+  return symbols;
+}
 
-  return name;
+void emitSharedAssertions(SmtLibParser &parser, llvm::Module &M,
+                          const llvm::Module &bvLib,
+                          ArrayRef<unsigned> assertionIdxs,
+                          bool liftConstants) {
+  Smt2LLVM smt2llvm(parser, M, bvLib, liftConstants);
+  for (unsigned idx : assertionIdxs)
+    smt2llvm.emitSharedAssertion(idx);
 }
 
 namespace {
-Smt2LLVM::Smt2LLVM(SmtLibParser &parser, llvm::Module &M)
-    : m_ctx(M.getContext()), m_module(M), m_parser(parser) {
-  m_bitvectorTy = m_module.getTypeByName("struct.bitvector_t");
+Smt2LLVM::Smt2LLVM(SmtLibParser &parser, llvm::Module &M,
+                   const llvm::Module &bvLib, bool liftConstants)
+    : m_ctx(M.getContext()), m_module(M), m_bvLib(bvLib), m_parser(parser),
+      m_liftConstants(liftConstants) {
+  assert(&bvLib.getContext() == &m_ctx);
+  m_bitvectorTy = m_bvLib.getTypeByName("struct.bitvector_t");
   assert(m_bitvectorTy);
 
-  m_bvaTy = m_module.getTypeByName("struct.bv_array_t");
+  m_bvaTy = m_bvLib.getTypeByName("struct.bv_array_t");
   assert(m_bvaTy);
   m_bvaPtrTy = m_bvaTy->getPointerTo(0);
 
+  m_bvpaTy = m_bvLib.getTypeByName("struct.bv_packed_array_t");
+  assert(m_bvpaTy);
+  m_bvpaPtrTy = m_bvpaTy->getPointerTo(0);
+
   m_i32Ty = Type::getInt32Ty(m_ctx);
   assert(m_i32Ty);
   m_i64Ty = Type::getInt64Ty(m_ctx);
@@ -130,65 +277,45 @@ Smt2LLVM::Smt2LLVM(SmtLibParser &parser, llvm::Module &M)
   m_i32One = ConstantInt::get(m_i32Ty, 1, false);
   assert(m_i32One);
 
-  m_bvPrintFn = m_module.getFunction("bv_print");
-  assert(m_bvPrintFn);
-  m_bvaPrintFn = m_module.getFunction("bva_print");
-  assert(m_bvaPrintFn);
-
-  m_bvMkFn = m_module.getFunction("bv_mk");
-  assert(m_bvMkFn);
-  assert(m_bvMkFn->getReturnType() == m_i64PairTy);
-
-  m_bvAddFn = m_module.getFunction("bv_add");
-  assert(m_bvAddFn);
-  assert(m_bvAddFn->arg_size() == 4);
-  m_bvMulFn = m_module.getFunction("bv_mul");
-  assert(m_bvMulFn);
-  assert(m_bvMulFn->arg_size() == 4);
-  m_bvAndFn = m_module.getFunction("bv_and");
-  assert(m_bvAndFn);
-  assert(m_bvAndFn->arg_size() == 4);
-  m_bvOrFn = m_module.getFunction("bv_or");
-  assert(m_bvOrFn);
-  assert(m_bvOrFn->arg_size() == 4);
-  m_bvConcatFn = m_module.getFunction("bv_concat");
-  assert(m_bvConcatFn);
-  assert(m_bvConcatFn->arg_size() == 4);
-  assert(m_bvConcatFn->getReturnType() == m_i64PairTy);
-
-  m_bvEqFn = m_module.getFunction("bv_eq");
-  assert(m_bvEqFn);
-  assert(m_bvEqFn->getReturnType() == m_i32Ty);
-  assert(m_bvEqFn->arg_size() == 4);
-  m_bvULTFn = m_module.getFunction("bv_ult");
-  assert(m_bvULTFn);
-  assert(m_bvULTFn->getReturnType() == m_i32Ty);
-  assert(m_bvULTFn->arg_size() == 4);
-  m_bvSLTFn = m_module.getFunction("bv_slt");
-  assert(m_bvSLTFn);
-  assert(m_bvSLTFn->getReturnType() == m_i32Ty);
-  assert(m_bvSLTFn->arg_size() == 4);
-
-  m_bvExtractFn = m_module.getFunction("bv_extract");
-  assert(m_bvExtractFn);
-  assert(m_bvExtractFn->arg_size() == 4);
-
-  m_bvZExtFn = m_module.getFunction("bv_zext");
-  assert(m_bvZExtFn);
-  m_bvSExtFn = m_module.getFunction("bv_sext");
-  assert(m_bvSExtFn);
-
-  m_bvaSelectFn = m_module.getFunction("bva_select");
-  assert(m_bvaSelectFn);
-}
-
-void Smt2LLVM::emitFormula(const Twine &funName) {
+  Function *bvaSelectFn = m_bvLib.getFunction("bva_select");
+  assert(bvaSelectFn);
+  m_fnAttrs = bvaSelectFn->getAttributes();
+}
+
+void Smt2LLVM::lowerAssertions(const Twine &funName,
+                               std::vector<std::string> *sharedNames) {
+  assert(m_assertFns.empty() && "Assertions already lowered");
+  const size_t numAssertions = m_parser.numAssertions();
+  const SmallVector<unsigned, 4> allArrays = getAllArrayIdxs();
+  for (size_t i = 0; i != numAssertions; ++i) {
+    const std::string assertName =
+        (funName + "_assert_" + std::to_string(i + 1)).str();
+    Function *assertFn = nullptr;
+    if (sharedNames) {
+      const CanonicalAssertion canonical = canonicalize(i);
+      sharedNames->push_back(getSharedAssertionName(canonical));
+      assertFn = emitSharedAssertionCall(i, assertName, canonical);
+    } else {
+      assertFn = lowerAssert(i, assertName, allArrays);
+    }
+    m_assertFns.push_back(assertFn);
+
+    LLVM_DEBUG(assertFn->dump());
+  }
+}
+
+Function *Smt2LLVM::emitFormula(const Twine &funName,
+                                ArrayRef<unsigned> order) {
+  const size_t numAssertions = m_parser.numAssertions();
+  assert(m_assertFns.size() == numAssertions && "Assertions not lowered yet");
   auto *funcTy = FunctionType::get(m_i32Ty, m_bvaPtrTy->getPointerTo(0), false);
 
+  // The formula keeps its external linkage, but is also marked as alwaysinline
+  // so that it gets inlined into the batch evaluation loop.
   Function *func =
       Function::Create(funcTy, GlobalValue::ExternalLinkage, funName, m_module);
-  func->setAttributes(m_bvaSelectFn->getAttributes());
-  func->removeFnAttr(Attribute::AlwaysInline);
+  func->setAttributes(m_fnAttrs);
+  func->addFnAttr(Attribute::AlwaysInline);
 
   Argument *arrPack = &*func->arg_begin();
   arrPack->setName("arrays");
@@ -196,26 +323,17 @@ void Smt2LLVM::emitFormula(const Twine &funName) {
   BasicBlock::Create(m_ctx, "entry", func);
   IRBuilder<> formulaBuilder(&func->front());
 
-  const size_t numArrays = m_parser.numArrays();
   SmallVector<Value *, 4> args;
-  args.reserve(numArrays);
-  {
-    size_t i = 0;
-    for (const ArrayInfo &ai : m_parser.arrays()) {
-      Value *arr = formulaBuilder.CreateInBoundsGEP(
-          arrPack, ConstantInt::get(m_i64Ty, i), {ai.name, ".ptr"});
-      Value *arg = formulaBuilder.CreateLoad(arr, ai.name);
-      args.push_back(arg);
-      ++i;
-    }
-  }
-
-  const size_t numAssertions = m_parser.numAssertions();
-  for (size_t i = 0; i != numAssertions; ++i) {
+  loadArrays(formulaBuilder, arrPack, args);
+
+  // Check the assertions in the requested order, but keep reporting failures
+  // with the original (file order) indices.
+  assert(order.empty() || order.size() == numAssertions);
+  for (size_t k = 0; k != numAssertions; ++k) {
+    const unsigned i = order.empty() ? k : order[k];
+    assert(i < numAssertions);
     const std::string caseName = std::to_string(i + 1);
-    Function *assertFn = lowerAssert(i, funName + "_assert");
-
-    LLVM_DEBUG(assertFn->dump());
+    Function *assertFn = m_assertFns[i];
 
     Value *res =
         formulaBuilder.CreateCall(assertFn, args, {"assert.", caseName});
@@ -236,6 +354,265 @@ void Smt2LLVM::emitFormula(const Twine &funName) {
   formulaBuilder.CreateRet(m_i32Zero);
 
   LLVM_DEBUG(func->dump());
+  return func;
+}
+
+Function *Smt2LLVM::emitBatchFormula(Function *formula, const Twine &name) {
+  assert(formula);
+  PointerType *packPtrTy = m_bvaPtrTy->getPointerTo(0)->getPointerTo(0);
+  auto *funcTy = FunctionType::get(
+      Type::getVoidTy(m_ctx), {packPtrTy, m_i64Ty, m_i32Ty->getPointerTo(0)},
+      false);
+
+  Function *func =
+      Function::Create(funcTy, GlobalValue::ExternalLinkage, name, m_module);
+  // Only take the function attributes of the formula (target cpu, features,
+  // etc.). The batch function writes to memory and must not be inlined.
+  AttrBuilder fnAttrs(formula->getAttributes().getFnAttributes());
+  fnAttrs.removeAttribute(Attribute::AlwaysInline);
+  fnAttrs.removeAttribute(Attribute::ReadOnly);
+  fnAttrs.removeAttribute(Attribute::ReadNone);
+  func->addAttributes(AttributeList::FunctionIndex, fnAttrs);
+
+  auto argIt = func->arg_begin();
+  Argument *packs = &*argIt++;
+  packs->setName("assignments");
+  packs->addAttr(Attribute::NoCapture);
+  packs->addAttr(Attribute::ReadOnly);
+  Argument *numPacks = &*argIt++;
+  numPacks->setName("n");
+  Argument *results = &*argIt;
+  results->setName("results");
+  results->addAttr(Attribute::NoCapture);
+  results->addAttr(Attribute::NoAlias);
+
+  auto *entry = BasicBlock::Create(m_ctx, "entry", func);
+  auto *loop = BasicBlock::Create(m_ctx, "loop", func);
+  auto *exit = BasicBlock::Create(m_ctx, "exit", func);
+
+  IRBuilder<> builder(entry);
+  Value *isEmpty = builder.CreateICmpEQ(numPacks, ConstantInt::get(m_i64Ty, 0),
+                                        "empty");
+  builder.CreateCondBr(isEmpty, exit, loop);
+
+  builder.SetInsertPoint(loop);
+  PHINode *idx = builder.CreatePHI(m_i64Ty, 2, "idx");
+  idx->addIncoming(ConstantInt::get(m_i64Ty, 0), entry);
+  Value *packPtr = builder.CreateInBoundsGEP(packs, idx, "pack.ptr");
+  Value *pack = builder.CreateLoad(packPtr, "pack");
+  Value *res = builder.CreateCall(formula, {pack}, "res");
+  Value *resPtr = builder.CreateInBoundsGEP(results, idx, "res.ptr");
+  builder.CreateStore(res, resPtr);
+  Value *next = builder.CreateNUWAdd(idx, ConstantInt::get(m_i64Ty, 1), "next");
+  idx->addIncoming(next, loop);
+  Value *done = builder.CreateICmpEQ(next, numPacks, "done");
+  builder.CreateCondBr(done, exit, loop);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  LLVM_DEBUG(func->dump());
+  return func;
+}
+
+Function *Smt2LLVM::emitFirstModelFormula(Function *formula,
+                                          const Twine &name) {
+  assert(formula);
+  PointerType *packPtrTy = m_bvaPtrTy->getPointerTo(0)->getPointerTo(0);
+  auto *funcTy = FunctionType::get(m_i64Ty, {packPtrTy, m_i64Ty}, false);
+
+  Function *func =
+      Function::Create(funcTy, GlobalValue::ExternalLinkage, name, m_module);
+  AttrBuilder fnAttrs(formula->getAttributes().getFnAttributes());
+  fnAttrs.removeAttribute(Attribute::AlwaysInline);
+  func->addAttributes(AttributeList::FunctionIndex, fnAttrs);
+
+  auto argIt = func->arg_begin();
+  Argument *packs = &*argIt++;
+  packs->setName("assignments");
+  packs->addAttr(Attribute::NoCapture);
+  packs->addAttr(Attribute::ReadOnly);
+  Argument *numPacks = &*argIt;
+  numPacks->setName("n");
+
+  auto *entry = BasicBlock::Create(m_ctx, "entry", func);
+  auto *loop = BasicBlock::Create(m_ctx, "loop", func);
+  auto *cont = BasicBlock::Create(m_ctx, "cont", func);
+  auto *found = BasicBlock::Create(m_ctx, "found", func);
+  auto *exit = BasicBlock::Create(m_ctx, "exit", func);
+
+  IRBuilder<> builder(entry);
+  Value *isEmpty = builder.CreateICmpEQ(numPacks, ConstantInt::get(m_i64Ty, 0),
+                                        "empty");
+  builder.CreateCondBr(isEmpty, exit, loop);
+
+  builder.SetInsertPoint(loop);
+  PHINode *idx = builder.CreatePHI(m_i64Ty, 2, "idx");
+  idx->addIncoming(ConstantInt::get(m_i64Ty, 0), entry);
+  Value *packPtr = builder.CreateInBoundsGEP(packs, idx, "pack.ptr");
+  Value *pack = builder.CreateLoad(packPtr, "pack");
+  Value *res = builder.CreateCall(formula, {pack}, "res");
+  Value *isModel = builder.CreateICmpEQ(res, m_i32Zero, "is_model");
+  builder.CreateCondBr(isModel, found, cont);
+
+  builder.SetInsertPoint(cont);
+  Value *next = builder.CreateNUWAdd(idx, ConstantInt::get(m_i64Ty, 1), "next");
+  idx->addIncoming(next, cont);
+  Value *done = builder.CreateICmpEQ(next, numPacks, "done");
+  builder.CreateCondBr(done, exit, loop);
+
+  builder.SetInsertPoint(found);
+  builder.CreateRet(idx);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRet(numPacks);
+
+  LLVM_DEBUG(func->dump());
+  return func;
+}
+
+Function *Smt2LLVM::emitDualFormula(const Twine &name) {
+  assert(!m_assertFns.empty());
+  assert(m_assertFns.size() == m_parser.numAssertions() &&
+         "Assertions not lowered yet");
+
+  // Same signature and attributes as smt_N, so that it also gets inlined into
+  // its batch loop.
+  auto *funcTy = FunctionType::get(m_i32Ty, m_bvaPtrTy->getPointerTo(0), false);
+  Function *func =
+      Function::Create(funcTy, GlobalValue::ExternalLinkage, name, m_module);
+  func->setAttributes(m_fnAttrs);
+  func->addFnAttr(Attribute::AlwaysInline);
+
+  Argument *arrPack = &*func->arg_begin();
+  arrPack->setName("arrays");
+
+  BasicBlock::Create(m_ctx, "entry", func);
+  IRBuilder<> builder(&func->front());
+
+  SmallVector<Value *, 4> args;
+  loadArrays(builder, arrPack, args);
+
+  // Check the constraints once, exiting early on the first failing one. The
+  // expression is only evaluated for assignments that satisfy them.
+  ArrayRef<Function *> constraints = makeArrayRef(m_assertFns).drop_back();
+  auto *blockFail = BasicBlock::Create(m_ctx, "constraints_fail", func);
+  for (size_t i = 0, e = constraints.size(); i != e; ++i) {
+    const std::string caseName = std::to_string(i + 1);
+    Value *res =
+        builder.CreateCall(constraints[i], args, {"assert.", caseName});
+    Value *success =
+        builder.CreateICmpEQ(res, m_i32One, {res->getName(), ".success"});
+
+    auto *blockSuccess = BasicBlock::Create(m_ctx, "cont", func, blockFail);
+    builder.CreateCondBr(success, blockSuccess, blockFail);
+    builder.SetInsertPoint(blockSuccess);
+  }
+
+  Value *expr = builder.CreateCall(m_assertFns.back(), args, "expr");
+  Value *exprBit = builder.CreateShl(expr, 1, "expr.bit");
+  builder.CreateRet(builder.CreateOr(
+      exprBit, ConstantInt::get(m_i32Ty, DualConstraintsHold), "dual"));
+
+  builder.SetInsertPoint(blockFail);
+  builder.CreateRet(m_i32Zero);
+
+  LLVM_DEBUG(func->dump());
+  return func;
+}
+
+void Smt2LLVM::loadArrays(IRBuilder<> &builder, Value *arrPack,
+                          SmallVectorImpl<Value *> &arrays) {
+  size_t i = 0;
+  for (const ArrayInfo &ai : m_parser.arrays()) {
+    Value *arr = builder.CreateInBoundsGEP(
+        arrPack, ConstantInt::get(m_i64Ty, i), {ai.name, ".ptr"});
+    Value *arg = builder.CreateLoad(arr, ai.name);
+    // Packed arrays are passed in the same pack slots as bv_arrays.
+    if (ai.isPacked())
+      arg = builder.CreateBitCast(arg, m_bvpaPtrTy, {ai.name, ".packed"});
+    arrays.push_back(arg);
+    ++i;
+  }
+}
+
+void Smt2LLVM::emitAssertionEntryPoints(ArrayRef<std::string> names) {
+  assert(names.size() == m_assertFns.size());
+  auto *funcTy = FunctionType::get(m_i32Ty, m_bvaPtrTy->getPointerTo(0), false);
+
+  for (size_t i = 0, e = names.size(); i != e; ++i) {
+    Function *func = Function::Create(funcTy, GlobalValue::ExternalLinkage,
+                                      names[i], m_module);
+    func->setAttributes(m_fnAttrs);
+    func->removeFnAttr(Attribute::AlwaysInline);
+
+    Argument *arrPack = &*func->arg_begin();
+    arrPack->setName("arrays");
+
+    BasicBlock::Create(m_ctx, "entry", func);
+    IRBuilder<> builder(&func->front());
+
+    SmallVector<Value *, 4> args;
+    loadArrays(builder, arrPack, args);
+    builder.CreateRet(builder.CreateCall(m_assertFns[i], args, "res"));
+
+    LLVM_DEBUG(func->dump());
+  }
+}
+
+Function *Smt2LLVM::emitLanesFormula(unsigned lanes, const Twine &name) {
+  assert(lanes > 0 && lanes <= FormulaEmitOptions::MaxLanes);
+  assert(m_assertFns.size() == m_parser.numAssertions() &&
+         "Assertions not lowered yet");
+
+  auto *funcTy = FunctionType::get(m_i32Ty, m_bvaPtrTy->getPointerTo(0), false);
+  Function *func =
+      Function::Create(funcTy, GlobalValue::ExternalLinkage, name, m_module);
+  func->setAttributes(m_fnAttrs);
+  func->removeFnAttr(Attribute::AlwaysInline);
+
+  Argument *block = &*func->arg_begin();
+  block->setName("block");
+
+  BasicBlock::Create(m_ctx, "entry", func);
+  IRBuilder<> builder(&func->front());
+
+  // Evaluate every lane with straight-line code: all the assertions are
+  // checked without early exits, so that the lanes are isomorphic and can be
+  // packed into vector registers by the SLP vectorizer.
+  Value *mask = m_i32Zero;
+  SmallVector<Value *, 4> args;
+  for (unsigned lane = 0; lane != lanes; ++lane) {
+    const std::string laneName = ".l" + std::to_string(lane);
+    args.clear();
+
+    size_t i = 0;
+    for (const ArrayInfo &ai : m_parser.arrays()) {
+      Value *arr = builder.CreateInBoundsGEP(
+          block, ConstantInt::get(m_i64Ty, i * lanes + lane),
+          ai.name + laneName + ".ptr");
+      Value *arg = builder.CreateLoad(arr, ai.name + laneName);
+      if (ai.isPacked())
+        arg = builder.CreateBitCast(arg, m_bvpaPtrTy,
+                                    ai.name + laneName + ".packed");
+      args.push_back(arg);
+      ++i;
+    }
+
+    Value *model = m_i32One;
+    for (Function *assertFn : m_assertFns) {
+      Value *res = builder.CreateCall(assertFn, args, {"assert", laneName});
+      model = builder.CreateAnd(model, res, {"model", laneName});
+    }
+
+    Value *bit = builder.CreateShl(model, lane, {"bit", laneName});
+    mask = builder.CreateOr(mask, bit, "mask");
+  }
+
+  builder.CreateRet(mask);
+
+  LLVM_DEBUG(func->dump());
+  return func;
 }
 
 bool IsIntegerConstant(StringRef val) {
@@ -243,25 +620,29 @@ bool IsIntegerConstant(StringRef val) {
 }
 
 std::pair<Function *, StringMap<Argument *>>
-Smt2LLVM::emitFunctionOverBVArrays(const Twine &name) {
-  const size_t numArrays = m_parser.numArrays();
-  SmallVector<Type *, 4> arrayTyInputs(numArrays);
-  for (auto &x : arrayTyInputs)
-    x = m_bvaPtrTy;
+Smt2LLVM::emitFunctionOverBVArrays(const Twine &name,
+                                   ArrayRef<unsigned> arrayIdxs,
+                                   bool constantTable) {
+  SmallVector<Type *, 4> arrayTyInputs;
+  for (unsigned i : arrayIdxs)
+    arrayTyInputs.push_back(getArrayPtrTy(m_parser.arrays()[i]));
+  if (constantTable)
+    arrayTyInputs.push_back(m_i64PtrTy);
 
   auto *funcTy = FunctionType::get(m_i32Ty, arrayTyInputs, false);
   Function *func =
       Function::Create(funcTy, GlobalValue::ExternalLinkage, name, m_module);
-  func->setAttributes(m_bvaSelectFn->getAttributes());
+  func->setAttributes(m_fnAttrs);
   func->setLinkage(GlobalVariable::LinkageTypes::PrivateLinkage);
   BasicBlock::Create(m_ctx, "entry", func);
 
-  assert(m_parser.numArrays() == func->arg_size());
+  assert(arrayIdxs.size() + constantTable == func->arg_size());
   auto argIt = func->arg_begin();
   const auto argEnd = func->arg_end();
 
   StringMap<Argument *> arrayToArg;
-  for (const ArrayInfo &ai : m_parser.arrays()) {
+  for (unsigned i : arrayIdxs) {
+    const ArrayInfo &ai = m_parser.arrays()[i];
     assert(argIt != argEnd);
     argIt->setName(ai.name);
     argIt->addAttr(Attribute::NoAlias);
@@ -273,22 +654,105 @@ Smt2LLVM::emitFunctionOverBVArrays(const Twine &name) {
     ++argIt;
   }
 
+  if (constantTable) {
+    // Assertions without literals get a null table.
+    argIt->setName("consts");
+    argIt->addAttr(Attribute::NoAlias);
+    argIt->addAttr(Attribute::NoCapture);
+    argIt->addAttr(Attribute::ReadOnly);
+  }
+
   return {func, std::move(arrayToArg)};
 }
 
-Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
+Function *Smt2LLVM::emitSharedAssertion(unsigned idx) {
+  assert(idx < m_parser.numAssertions());
+  const CanonicalAssertion canonical = canonicalize(idx);
+  const std::string name = getSharedAssertionName(canonical);
+  if (Function *existing = m_module.getFunction(name))
+    return existing;
+
+  Function *func = lowerAssert(idx, name, canonical.arrays, m_liftConstants);
+  func->setLinkage(GlobalValue::ExternalLinkage);
+  func->removeFnAttr(Attribute::AlwaysInline);
+
+  LLVM_DEBUG(func->dump());
+  return func;
+}
+
+Function *Smt2LLVM::emitSharedAssertionCall(
+    unsigned idx, const Twine &name, const CanonicalAssertion &canonical) {
+  assert(idx < m_parser.numAssertions());
+
+  // Declare the shared function, which is defined in another module.
+  const std::string sharedName = getSharedAssertionName(canonical);
+  Function *shared = m_module.getFunction(sharedName);
+  if (!shared) {
+    SmallVector<Type *, 4> arrayTyInputs;
+    for (unsigned i : canonical.arrays)
+      arrayTyInputs.push_back(getArrayPtrTy(m_parser.arrays()[i]));
+    if (m_liftConstants)
+      arrayTyInputs.push_back(m_i64PtrTy);
+    auto *sharedTy = FunctionType::get(m_i32Ty, arrayTyInputs, false);
+    shared = Function::Create(sharedTy, GlobalValue::ExternalLinkage,
+                              sharedName, m_module);
+  }
+
+  // The local stub has the same signature as the lowered assertions, and
+  // passes on the arrays the assertion reads.
+  auto funcArraysPair = emitFunctionOverBVArrays(name, getAllArrayIdxs());
+  Function *func = funcArraysPair.first;
+  func->addFnAttr(Attribute::AlwaysInline);
+
+  SmallVector<Value *, 4> args;
+  for (unsigned i : canonical.arrays)
+    args.push_back(func->arg_begin() + i);
+
+  if (m_liftConstants) {
+    // The literals of this instance of the shape.
+    Value *table = ConstantPointerNull::get(m_i64PtrTy);
+    if (!canonical.constants.empty()) {
+      Constant *values =
+          ConstantDataArray::get(m_ctx, makeArrayRef(canonical.constants));
+      auto *global = new GlobalVariable(
+          m_module, values->getType(), /* isConstant = */ true,
+          GlobalValue::PrivateLinkage, values, name + ".consts");
+      table = ConstantExpr::getInBoundsGetElementPtr(
+          values->getType(), global,
+          ArrayRef<Constant *>{m_i32Zero, m_i32Zero});
+    }
+    args.push_back(table);
+  }
+
+  IRBuilder<> builder(&func->front());
+  builder.CreateRet(builder.CreateCall(shared, args, "res"));
+
+  return func;
+}
+
+Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name,
+                                ArrayRef<unsigned> arrayIdxs,
+                                bool liftConstants) {
   assert(idx < m_parser.numAssertions());
   Sexp &assertion = m_parser.assertions()[idx];
 
   auto funcArraysPair =
-      emitFunctionOverBVArrays(name + "_" + std::to_string(idx + 1));
+      emitFunctionOverBVArrays(name, arrayIdxs, liftConstants);
   Function *func = funcArraysPair.first;
   StringMap<Argument *> &arrayToArg = funcArraysPair.second;
+  m_argArrayIdxs.assign(arrayIdxs.begin(), arrayIdxs.end());
+
+  // Lifted literals are loaded from the table in the order they appear in,
+  // which is the order of CanonicalAssertion::constants.
+  Value *constTable = liftConstants ? &*std::prev(func->arg_end()) : nullptr;
+  unsigned numLifted = 0;
 
   m_builder = llvm::make_unique<IRBuilder<>>(&func->front());
 
-  SmallVector<Value *, 4> valueStack;
-  auto stackPush = [&valueStack](Value *val) { valueStack.push_back(val); };
+  SmallVector<LoweredValue, 4> valueStack;
+  auto stackPush = [&valueStack](LoweredValue val) {
+    valueStack.push_back(val);
+  };
   auto stackPop = [&valueStack] {
     assert(!valueStack.empty());
     return valueStack.pop_back_val();
@@ -298,7 +762,7 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
                   : SexpPostOrderRange(assertion)) llvm::errs()
              << view << "\n");
 
-  StringMap<Value *> letToVal;
+  StringMap<LoweredValue> letToVal;
 
   for (SexpPostOrderView view : SexpPostOrderRange(assertion)) {
     LLVM_DEBUG(llvm::errs() << view << "\n");
@@ -322,12 +786,12 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
 
       if (view.sexp->isNumber()) {
         const auto num = view.sexp->toNumber();
-        stackPush(lowerIntegerConstant(num));
+        stackPush({lowerIntegerConstant(num)});
         continue;
       }
 
       if (str == "false") {
-        stackPush(m_i32Zero);
+        stackPush({m_i32Zero});
         continue;
       }
 
@@ -335,7 +799,7 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
         StringRef remainder = str.substr(2);
         assert(IsIntegerConstant(remainder));
         const long long num = std::stoll(remainder.str());
-        stackPush(lowerIntegerConstant(num));
+        stackPush({lowerIntegerConstant(num)});
         continue;
       }
 
@@ -345,12 +809,7 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
       }
 
       if (arrayToArg.count(str) > 0) {
-        stackPush(arrayToArg[str]);
-        continue;
-      }
-
-      if (letToVal.count(str) > 0) {
-        stackPush(letToVal[str]);
+        stackPush({arrayToArg[str]});
         continue;
       }
 
@@ -365,42 +824,48 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
         assert(parent.getChild(1).isString());
         StringRef realFn = parent.getChild(1).getString();
         if (realFn.startswith("bv")) {
-          Value *width = stackPop();
-          Value *constant = stackPop();
+          const unsigned width = getIntegerParam(stackPop());
+          Value *constant = stackPop().val;
+          if (constTable) {
+            Value *constPtr = m_builder->CreateInBoundsGEP(
+                constTable, ConstantInt::get(m_i64Ty, numLifted++),
+                "const.ptr");
+            constant = m_builder->CreateLoad(constPtr, "const");
+          }
           stackPush(lowerBVMk(constant, width, parent.getChild(1).getString()));
         } else if (realFn == "extract") {
-          Value *from = stackPop();
-          Value *to = stackPop();
-          Value *bv = stackPop();
+          const unsigned from = getIntegerParam(stackPop());
+          const unsigned to = getIntegerParam(stackPop());
+          const LoweredValue bv = stackPop();
           stackPush(lowerExtract(bv, from, to));
         } else if (realFn == "zero_extend") {
-          Value *width = stackPop();
-          Value *bv = stackPop();
+          const unsigned width = getIntegerParam(stackPop());
+          const LoweredValue bv = stackPop();
           stackPush(lowerZExt(bv, width));
         } else if (realFn == "sign_extend") {
-          Value *width = stackPop();
-          Value *bv = stackPop();
+          const unsigned width = getIntegerParam(stackPop());
+          const LoweredValue bv = stackPop();
           stackPush(lowerSExt(bv, width));
         }
         continue;
       }
 
       if (str == "and") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerAnd(lhs, rhs));
+        Value *rhs = stackPop().val;
+        Value *lhs = stackPop().val;
+        stackPush({lowerAnd(lhs, rhs)});
         continue;
       }
 
       if (str == "or") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerOr(lhs, rhs));
+        Value *rhs = stackPop().val;
+        Value *lhs = stackPop().val;
+        stackPush({lowerOr(lhs, rhs)});
         continue;
       }
 
       // Let definition.
-      if (str.startswith(R"(\?)")) {
+      if (str.startswith("?")) {
         letToVal[str] = stackPop();
         continue;
       }
@@ -412,71 +877,76 @@ Function *Smt2LLVM::lowerAssert(unsigned idx, const Twine &name) {
       }
 
       if (str == "select") {
-        Value *index = stackPop();
-        Value *arr = stackPop();
-        stackPush(lowerSelect(arr, index));
+        const LoweredValue index = stackPop();
+        const LoweredValue arr = stackPop();
+        stackPush(lowerSelect(cast<Argument>(arr.val), index));
         continue;
       }
 
       if (str == "bvadd") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerBvBinaryFn(lhs, rhs, m_bvAddFn, "bvadd"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush(
+            lowerBinaryOp(lhs, rhs, Instruction::Add, "bv_add", "bvadd"));
         continue;
       }
 
       if (str == "bvmul") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerBvBinaryFn(lhs, rhs, m_bvMulFn, "bvmul"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush(
+            lowerBinaryOp(lhs, rhs, Instruction::Mul, "bv_mul", "bvmul"));
         continue;
       }
 
       if (str == "bvand") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerBvBinaryFn(lhs, rhs, m_bvAndFn, "bvand"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush(
+            lowerBinaryOp(lhs, rhs, Instruction::And, "bv_and", "bvand"));
         continue;
       }
 
       if (str == "bvult") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerLessThan(lhs, rhs, false, "ult"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush({lowerLessThan(lhs, rhs, false, "ult")});
         continue;
       }
 
       if (str == "bvslt") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerLessThan(lhs, rhs, true, "slt"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush({lowerLessThan(lhs, rhs, true, "slt")});
         continue;
       }
 
       if (str == "bvor") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerBvBinaryFn(lhs, rhs, m_bvOrFn, "bvor"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush(
+            lowerBinaryOp(lhs, rhs, Instruction::Or, "bv_or", "bvor"));
         continue;
       }
 
       if (str == "concat") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerBvBinaryFn(lhs, rhs, m_bvConcatFn, "concat"));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush(lowerConcat(lhs, rhs));
         continue;
       }
 
       if (str == "=") {
-        Value *rhs = stackPop();
-        Value *lhs = stackPop();
-        stackPush(lowerCmp(lhs, rhs));
+        const LoweredValue rhs = stackPop();
+        const LoweredValue lhs = stackPop();
+        stackPush({lowerCmp(lhs, rhs)});
         continue;
       }
 
       if (str == "assert") {
-        Value *res = stackPop();
-        m_builder->CreateRet(res);
+        const LoweredValue res = stackPop();
+        assert(res.val->getType() == m_i32Ty);
+        m_builder->CreateRet(res.val);
         break;
       }
 
@@ -506,19 +976,76 @@ std::pair<Value *, Value *> Smt2LLVM::unpackI64Pair(Value *valPair) {
   return {first, second};
 }
 
-Value *Smt2LLVM::lowerBVMk(Value *constant, Value *width, const Twine &name) {
-  Value *c = m_builder->CreateSExtOrTrunc(constant, m_i64Ty);
-  Value *w = m_builder->CreateZExtOrTrunc(width, m_i32Ty);
-  return m_builder->CreateCall(m_bvMkFn, {w, c}, name);
+Value *Smt2LLVM::getBits(const LoweredValue &bv, IntegerType *ty) {
+  assert(bv.isBitVector());
+  Value *bits = bv.val;
+  if (!bv.isNative()) {
+    assert(bv.val->getType() == m_i64PairTy);
+    bits = m_builder->CreateExtractValue(bv.val, {1}, bv.val->getName() +
+                                                          ".bits");
+  }
+  return m_builder->CreateZExtOrTrunc(bits, ty);
 }
 
-Value *Smt2LLVM::lowerCmp(Value *lhs, Value *rhs, const Twine &name) {
-  assert(lhs->getType() == rhs->getType());
+Value *Smt2LLVM::packBitVector(Value *bits, unsigned width) {
+  // bitvector_t is {width, occupied_width, bits}, passed as {i64, i64}.
+  Value *bits64 = m_builder->CreateZExtOrTrunc(bits, m_i64Ty);
+  Function *ctlzFn =
+      Intrinsic::getDeclaration(&m_module, Intrinsic::ctlz, {m_i64Ty});
+  Value *leadingZeros =
+      m_builder->CreateCall(ctlzFn, {bits64, m_builder->getFalse()});
+  Value *occupied =
+      m_builder->CreateSub(ConstantInt::get(m_i64Ty, 64), leadingZeros);
+  Value *header = m_builder->CreateOr(m_builder->CreateShl(occupied, 32),
+                                      ConstantInt::get(m_i64Ty, width));
+
+  Value *bv = m_builder->CreateInsertValue(UndefValue::get(m_i64PairTy),
+                                           header, {0});
+  return m_builder->CreateInsertValue(bv, bits64, {1}, "bv");
+}
+
+Value *Smt2LLVM::toBitVector(const LoweredValue &bv) {
+  assert(bv.isBitVector());
+  return bv.isNative() ? packBitVector(bv.val, bv.width) : bv.val;
+}
 
-  if (!lhs->getType()->isIntegerTy())
-    return lowerEq(lhs, rhs);
+Smt2LLVM::LoweredValue Smt2LLVM::fromBitVector(Value *bv, unsigned width) {
+  assert(bv->getType() == m_i64PairTy);
+  if (width > MaxNativeWidth)
+    return {bv, width};
+
+  return {m_builder->CreateExtractValue(bv, {1}, bv->getName() + ".bits"),
+          width};
+}
+
+Smt2LLVM::LoweredValue Smt2LLVM::lowerBVMk(Value *constant, unsigned width,
+                                           const Twine &name) {
+  assert(constant->getType() == m_i64Ty);
+  if (width <= MaxNativeWidth) {
+    // Truncation drops the bits that do not fit, like bv_mk.
+    return {m_builder->CreateZExtOrTrunc(constant, getIntTy(width), name),
+            width};
+  }
+
+  Value *w = ConstantInt::get(m_i32Ty, width);
+  return {
+      m_builder->CreateCall(getBVLibFunction("bv_mk"), {w, constant}, name),
+      width};
+}
+
+Value *Smt2LLVM::lowerCmp(const LoweredValue &lhs, const LoweredValue &rhs,
+                          const Twine &name) {
+  assert(lhs.isBitVector() == rhs.isBitVector());
+  Value *cmp = nullptr;
+  if (!lhs.isBitVector()) {
+    assert(lhs.val->getType() == rhs.val->getType());
+    cmp = m_builder->CreateICmpEQ(lhs.val, rhs.val, name);
+  } else {
+    // Like bv_eq, only compares the bits.
+    IntegerType *ty = getIntTy(std::max(getNumBits(lhs), getNumBits(rhs)));
+    cmp = m_builder->CreateICmpEQ(getBits(lhs, ty), getBits(rhs, ty), name);
+  }
 
-  Value *cmp = m_builder->CreateICmpEQ(lhs, rhs, name);
   return m_builder->CreateZExt(cmp, m_i32Ty, {cmp->getName(), ".z"});
 }
 
@@ -534,6 +1061,28 @@ Value *Smt2LLVM::lowerOr(Value *lhs, Value *rhs, const Twine &name) {
   return m_builder->CreateOr(lhs, rhs, name);
 }
 
+Smt2LLVM::LoweredValue Smt2LLVM::lowerBinaryOp(const LoweredValue &lhs,
+                                               const LoweredValue &rhs,
+                                               Instruction::BinaryOps op,
+                                               StringRef bvFnName,
+                                               const Twine &name) {
+  assert(lhs.isBitVector() && rhs.isBitVector());
+  // The result has the width of lhs, as in bvlib.
+  if (!lhs.isNative())
+    return {lowerBvBinaryFn(lhs.val, toBitVector(rhs),
+                            getBVLibFunction(bvFnName), name),
+            lhs.width};
+
+  // Sums and products wrap around at the width, while bvand and bvor keep all
+  // the bits of their operands.
+  const bool wraps = op == Instruction::Add || op == Instruction::Mul;
+  IntegerType *ty =
+      wraps ? getIntTy(lhs.width)
+            : getIntTy(std::max(getNumBits(lhs), getNumBits(rhs)));
+  return {m_builder->CreateBinOp(op, getBits(lhs, ty), getBits(rhs, ty), name),
+          lhs.width};
+}
+
 Value *Smt2LLVM::lowerBvBinaryFn(Value *lhs, Value *rhs, Function *op,
                                  const Twine &name) {
   assert(lhs->getType() == rhs->getType());
@@ -547,62 +1096,163 @@ Value *Smt2LLVM::lowerBvBinaryFn(Value *lhs, Value *rhs, Function *op,
                                name);
 }
 
-Value *Smt2LLVM::lowerEq(Value *lhs, Value *rhs, const Twine &name) {
-  assert(lhs->getType() == m_i64PairTy);
-  assert(rhs->getType() == m_i64PairTy);
-  auto lhsUnpacked = unpackI64Pair(lhs);
-  auto rhsUnpacked = unpackI64Pair(rhs);
-  return m_builder->CreateCall(m_bvEqFn,
-                               {lhsUnpacked.first, lhsUnpacked.second,
-                                rhsUnpacked.first, rhsUnpacked.second},
-                               name);
+Value *Smt2LLVM::lowerLessThan(const LoweredValue &lhs,
+                               const LoweredValue &rhs, bool isSigned,
+                               const Twine &name) {
+  assert(lhs.isBitVector() && rhs.isBitVector());
+  IntegerType *ty = getIntTy(std::max(getNumBits(lhs), getNumBits(rhs)));
+  Value *cmp = nullptr;
+  if (!isSigned) {
+    cmp = m_builder->CreateICmpULT(getBits(lhs, ty), getBits(rhs, ty), name);
+  } else if (!lhs.isNative() || !rhs.isNative()) {
+    auto lhsUnpacked = unpackI64Pair(toBitVector(lhs));
+    auto rhsUnpacked = unpackI64Pair(toBitVector(rhs));
+    return m_builder->CreateCall(getBVLibFunction("bv_slt"),
+                                 {lhsUnpacked.first, lhsUnpacked.second,
+                                  rhsUnpacked.first, rhsUnpacked.second},
+                                 name);
+  } else if (lhs.width == rhs.width && getNumBits(lhs) == lhs.width &&
+             getNumBits(rhs) == rhs.width) {
+    cmp = m_builder->CreateICmpSLT(lhs.val, rhs.val, name);
+  } else {
+    // bv_slt: an unsigned comparison, flipped when the bits above the sign
+    // bits differ.
+    Value *lhsBits = getBits(lhs, ty);
+    Value *rhsBits = getBits(rhs, ty);
+    Value *lhsSign = m_builder->CreateLShr(lhsBits, lhs.width - 1);
+    Value *rhsSign = m_builder->CreateLShr(rhsBits, rhs.width - 1);
+    cmp = m_builder->CreateXor(m_builder->CreateICmpULT(lhsBits, rhsBits),
+                               m_builder->CreateICmpNE(lhsSign, rhsSign), name);
+  }
+
+  return m_builder->CreateZExt(cmp, m_i32Ty, {cmp->getName(), ".z"});
 }
 
-Value *Smt2LLVM::lowerLessThan(Value *lhs, Value *rhs, bool isSigned,
-                               const Twine &name) {
-  assert(lhs->getType() == m_i64PairTy);
-  assert(rhs->getType() == m_i64PairTy);
-  auto lhsUnpacked = unpackI64Pair(lhs);
-  auto rhsUnpacked = unpackI64Pair(rhs);
-  return m_builder->CreateCall(isSigned ? m_bvSLTFn : m_bvULTFn,
-                               {lhsUnpacked.first, lhsUnpacked.second,
-                                rhsUnpacked.first, rhsUnpacked.second},
-                               name);
+Smt2LLVM::LoweredValue Smt2LLVM::lowerConcat(const LoweredValue &lhs,
+                                             const LoweredValue &rhs,
+                                             const Twine &name) {
+  assert(lhs.isBitVector() && rhs.isBitVector());
+  const unsigned width = lhs.width + rhs.width;
+  if (width > MaxNativeWidth) {
+    Value *bv = lowerBvBinaryFn(toBitVector(lhs), toBitVector(rhs),
+                                getBVLibFunction("bv_concat"), name);
+    return {bv, width};
+  }
+
+  // bv_concat places the bits of rhs above the bits of lhs, in a single word.
+  unsigned numBits = std::max(getNumBits(lhs), getNumBits(rhs) + lhs.width);
+  if (numBits > MaxNativeWidth)
+    numBits = MaxNativeWidth;
+  IntegerType *ty = getIntTy(numBits);
+  Value *high = m_builder->CreateShl(getBits(rhs, ty), lhs.width);
+  return {m_builder->CreateOr(high, getBits(lhs, ty), name), width};
 }
 
-Value *Smt2LLVM::lowerExtract(Value *bv, Value *from, Value *to,
-                              const Twine &name) {
-  assert(from->getType()->isIntegerTy());
-  assert(to->getType()->isIntegerTy());
-  auto unpacked = unpackI64Pair(bv);
-  Value *f = m_builder->CreateZExtOrTrunc(from, m_i32Ty);
-  Value *t = m_builder->CreateZExtOrTrunc(to, m_i32Ty);
-  return m_builder->CreateCall(m_bvExtractFn,
-                               {unpacked.first, unpacked.second, f, t}, name);
+Smt2LLVM::LoweredValue Smt2LLVM::lowerExtract(const LoweredValue &bv,
+                                              unsigned from, unsigned to,
+                                              const Twine &name) {
+  assert(bv.isBitVector());
+  assert(from <= to);
+  const unsigned width = to - from + 1;
+  if (to >= MaxNativeWidth) {
+    auto unpacked = unpackI64Pair(toBitVector(bv));
+    Value *res = m_builder->CreateCall(
+        getBVLibFunction("bv_extract"),
+        {unpacked.first, unpacked.second, ConstantInt::get(m_i32Ty, from),
+         ConstantInt::get(m_i32Ty, to)},
+        name);
+    return fromBitVector(res, width);
+  }
+
+  Value *bits = getBits(bv, getIntTy(std::max(getNumBits(bv), to + 1)));
+  if (from != 0)
+    bits = m_builder->CreateLShr(bits, from);
+  return {m_builder->CreateTrunc(bits, getIntTy(width), name), width};
 }
 
-Value *Smt2LLVM::lowerZExt(Value *val, Value *width, const Twine &name) {
-  assert(width->getType()->isIntegerTy());
-  auto unpacked = unpackI64Pair(val);
-  Value *w = m_builder->CreateZExtOrTrunc(width, m_i32Ty);
-  return m_builder->CreateCall(m_bvZExtFn, {unpacked.first, unpacked.second, w},
-                               name);
+Smt2LLVM::LoweredValue Smt2LLVM::lowerZExt(const LoweredValue &bv,
+                                           unsigned width, const Twine &name) {
+  assert(bv.isBitVector());
+  // bv_zext keeps the bits, and only changes the width.
+  if (width > MaxNativeWidth)
+    return {packBitVector(getBits(bv, m_i64Ty), width), width};
+
+  if (!bv.isNative())
+    return {getBits(bv, m_i64Ty), width};
+
+  if (getNumBits(bv) >= width)
+    return {bv.val, width};
+
+  return {m_builder->CreateZExt(bv.val, getIntTy(width), name), width};
 }
 
-Value *Smt2LLVM::lowerSExt(Value *val, Value *width, const Twine &name) {
-  assert(width->getType()->isIntegerTy());
-  auto unpacked = unpackI64Pair(val);
-  Value *w = m_builder->CreateZExtOrTrunc(width, m_i32Ty);
-  return m_builder->CreateCall(m_bvSExtFn, {unpacked.first, unpacked.second, w},
-                               name);
+Smt2LLVM::LoweredValue Smt2LLVM::lowerSExt(const LoweredValue &bv,
+                                           unsigned width, const Twine &name) {
+  assert(bv.isBitVector());
+  if (width > MaxNativeWidth || !bv.isNative() ||
+      bv.width == MaxNativeWidth) {
+    auto unpacked = unpackI64Pair(toBitVector(bv));
+    Value *w = ConstantInt::get(m_i32Ty, width);
+    Value *res = m_builder->CreateCall(getBVLibFunction("bv_sext"),
+                                       {unpacked.first, unpacked.second, w},
+                                       name);
+    return fromBitVector(res, width);
+  }
+
+  IntegerType *ty = getIntTy(width);
+  if (getNumBits(bv) == bv.width)
+    return {m_builder->CreateSExtOrTrunc(bv.val, ty, name), width};
+
+  // bv_sext: the bits above the sign bit are set if it is not zero.
+  Value *bits = getBits(bv, m_i64Ty);
+  Value *pad = m_builder->CreateLShr(bits, bv.width - 1);
+  Value *mask = m_builder->CreateSelect(
+      m_builder->CreateICmpEQ(pad, ConstantInt::get(m_i64Ty, 0)),
+      ConstantInt::get(m_i64Ty, 0),
+      ConstantInt::get(m_i64Ty, ~0ull << bv.width));
+  return {m_builder->CreateTrunc(m_builder->CreateOr(bits, mask), ty, name),
+          width};
 }
 
-Value *Smt2LLVM::lowerSelect(Value *array, Value *index, const Twine &name) {
+Smt2LLVM::LoweredValue Smt2LLVM::lowerSelect(Argument *array,
+                                             const LoweredValue &index,
+                                             const Twine &name) {
+  if (array->getType() == m_bvpaPtrTy)
+    return lowerPackedSelect(array, index, name);
+
   assert(array->getType() == m_bvaPtrTy);
-  assert(index->getType() == m_i64PairTy);
-  auto firstSecond = unpackI64Pair(index);
-  return m_builder->CreateCall(
-      m_bvaSelectFn, {array, firstSecond.first, firstSecond.second}, name);
+  auto firstSecond = unpackI64Pair(toBitVector(index));
+  Value *res = m_builder->CreateCall(
+      getBVLibFunction("bva_select"),
+      {array, firstSecond.first, firstSecond.second}, name);
+  return fromBitVector(res, getArgArray(array).element_width);
+}
+
+Smt2LLVM::LoweredValue Smt2LLVM::lowerPackedSelect(Argument *array,
+                                                   const LoweredValue &index,
+                                                   const Twine &name) {
+  assert(array->getType() == m_bvpaPtrTy);
+  const ArrayInfo &ai = getArgArray(array);
+  assert(ai.isPacked());
+  const unsigned width = ai.element_width;
+  IntegerType *elementTy = getIntTy(width <= 8    ? 8
+                                    : width <= 16 ? 16
+                                    : width <= 32 ? 32
+                                                  : 64);
+
+  // Same as bvpa_select: reads past the end return the default value, stored
+  // after the last element.
+  Value *idx = getBits(index, m_i64Ty);
+  Value *lenPtr = m_builder->CreateStructGEP(m_bvpaTy, array, 0);
+  Value *len = m_builder->CreateLoad(lenPtr, ai.name + ".len");
+  idx = m_builder->CreateSelect(m_builder->CreateICmpULT(idx, len), idx, len,
+                                "idx");
+
+  Value *bytes = m_builder->CreateStructGEP(m_bvpaTy, array, 1);
+  Value *elements =
+      m_builder->CreateBitCast(bytes, elementTy->getPointerTo(0));
+  Value *elementPtr = m_builder->CreateInBoundsGEP(elements, idx);
+  return {m_builder->CreateLoad(elementPtr, name), width};
 }
 
 } // namespace
@@ -1,12 +1,99 @@
 #pragma once
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Module.h"
 
 #include <string>
+#include <vector>
 
 namespace smt_jit {
 class SmtLibParser;
 
-std::string emitSmtFormula(SmtLibParser &parser, llvm::Module &M);
+// Names of the entry points emitted for a single SMT formula.
+struct FormulaSymbols {
+  // int smt_N(bv_array **arrays): returns 0 if the arrays model the formula,
+  // or the 1-based index of the first failing assertion. With
+  // FormulaEmitOptions::dual, smt_N is not emitted, and this is only the base
+  // name of the other entry points.
+  std::string formula;
+  // void smt_N_batch(bv_array ***assignments, size_t n, int *results):
+  // evaluates smt_N on n array packs and stores the results. Not emitted with
+  // FormulaEmitOptions::dual.
+  std::string batch;
+  // size_t smt_N_first(bv_array ***assignments, size_t n): returns the index
+  // of the first array pack that models the formula, or n if there is none.
+  // Stops at the first model. Only emitted when FormulaEmitOptions::first is
+  // set.
+  std::string first;
+  // unsigned smt_N_lanes(bv_array **block): evaluates the formula on a
+  // column-major block of assignments (block[array * lanes + lane]) and
+  // returns the mask of lanes that model the formula. Only emitted when
+  // FormulaEmitOptions::lanes is set.
+  std::string lanes;
+  // unsigned smt_N_dual(bv_array **arrays): treats the last assertion as a
+  // query expression and the remaining ones as constraints. Returns 0 if the
+  // constraints do not hold, and otherwise DualConstraintsHold, plus
+  // DualExprTrue if the expression holds too. Only emitted when
+  // FormulaEmitOptions::dual is set.
+  std::string dual;
+  // void smt_N_dual_batch(bv_array ***assignments, size_t n, int *results):
+  // evaluates smt_N_dual on n array packs.
+  std::string dualBatch;
+  // int smt_N_check_K(bv_array **arrays): returns 1 if the K-th (1-based)
+  // assertion holds, and 0 otherwise; in the assertion order. Only emitted
+  // when FormulaEmitOptions::assertionEntryPoints is set.
+  std::vector<std::string> assertions;
+  // int smt_assert_H(...): the shared functions the assertions are evaluated
+  // with, where H is the hash of the canonical assertion (CanonicalAssertion)
+  // and the parameters are the arrays it reads. They are not defined in the
+  // formula module; see emitSharedAssertions. Only set when
+  // FormulaEmitOptions::shareAssertions is set. With
+  // FormulaEmitOptions::liftConstants, these are smt_shape_H functions that
+  // also take the table of the assertion literals (const uint64_t *).
+  std::vector<std::string> sharedAssertions;
+};
+
+enum DualResult : unsigned { DualConstraintsHold = 1, DualExprTrue = 2 };
+
+struct FormulaEmitOptions {
+  // Base name of the entry points (smt_N above); empty picks a fresh smt_N.
+  std::string name;
+  // Number of assignments evaluated at once by the lanes variant; 0 disables
+  // it. At most MaxLanes.
+  unsigned lanes = 0;
+  // Emit the first-model search (smt_N_first). Not supported with dual.
+  bool first = false;
+  // Order in which smt_N checks the assertions, as a permutation of their
+  // indices; empty means the file order. The results still refer to the
+  // original (1-based) assertion indices.
+  std::vector<unsigned> assertionOrder;
+  // Emit the dual-polarity variant, which evaluates the shared constraints
+  // once for both constraints /\ expr and constraints /\ !expr, instead of
+  // smt_N and the entry points built on it.
+  bool dual = false;
+  // Emit an entry point for every assertion, e.g., for delta evaluation.
+  bool assertionEntryPoints = false;
+  // Call the assertions through functions shared by all the formulas with
+  // the same canonical assertions, instead of lowering them.
+  bool shareAssertions = false;
+  // Pass the bitvector literals of the shared assertions in a constant table,
+  // so that the assertions that only differ in the literals share a function.
+  // Requires shareAssertions.
+  bool liftConstants = false;
+
+  static constexpr unsigned MaxLanes = 32;
+};
+
+// Emits the formula into M, importing the bvlib functions it uses from the
+// bvlib template (see CreateFormulaModule).
+FormulaSymbols emitSmtFormula(SmtLibParser &parser, llvm::Module &M,
+                              const llvm::Module &bvLib,
+                              const FormulaEmitOptions &options = {});
+// Emits the shared functions (smt_assert_H, or smt_shape_H with lifted
+// constants) of the given assertions.
+void emitSharedAssertions(SmtLibParser &parser, llvm::Module &M,
+                          const llvm::Module &bvLib,
+                          llvm::ArrayRef<unsigned> assertionIdxs,
+                          bool liftConstants = false);
 } // namespace smt_jit
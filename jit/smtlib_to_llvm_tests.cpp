@@ -0,0 +1,382 @@
+#include "doctest.h"
+
+#include "assignment_table.hpp"
+#include "bvlib_cloner.hpp"
+#include "bytecode.hpp"
+#include "smtlib_parser.hpp"
+#include "smtlib_to_llvm.hpp"
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace smt_jit;
+
+struct FormulaModules {
+  std::unique_ptr<llvm::Module> bvlib;
+  std::unique_ptr<llvm::Module> bvlibTemplate;
+  std::unique_ptr<llvm::Module> formula;
+};
+
+// Loads the bvlib IR built next to the tests, and creates an empty formula
+// module from its prepared template.
+static FormulaModules prepareFormulaModules(llvm::LLVMContext &ctx) {
+  FormulaModules modules;
+  llvm::SMDiagnostic error;
+  modules.bvlib = llvm::parseIRFile(SMTJIT_BVLIB_IR, error, ctx);
+  REQUIRE(modules.bvlib);
+  modules.bvlibTemplate = CloneDeclarationsAndPrepare(*modules.bvlib);
+  REQUIRE(modules.bvlibTemplate);
+  modules.formula = CreateFormulaModule(*modules.bvlibTemplate);
+  return modules;
+}
+
+// Compiles formulas together with bvlib, and with the shared assertion
+// functions they call.
+class FormulaJit {
+  llvm::orc::ThreadSafeContext m_ctx;
+  FormulaModules m_modules;
+  std::unique_ptr<llvm::orc::LLJIT> m_jit;
+  // As in smt-jit, each shared assertion function is only emitted once.
+  std::set<std::string> m_sharedAssertions;
+
+public:
+  FormulaJit()
+      : m_ctx(llvm::make_unique<llvm::LLVMContext>()),
+        m_modules(prepareFormulaModules(*m_ctx.getContext())) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    m_jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+    m_jit->getMainJITDylib().setGenerator(llvm::cantFail(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            m_jit->getDataLayout().getGlobalPrefix())));
+    llvm::cantFail(m_jit->addIRModule(
+        llvm::orc::ThreadSafeModule(std::move(m_modules.bvlib), m_ctx)));
+  }
+
+  FormulaSymbols addFormula(SmtLibParser &parser,
+                            const FormulaEmitOptions &options = {}) {
+    std::unique_ptr<llvm::Module> formula =
+        m_modules.formula ? std::move(m_modules.formula)
+                          : CreateFormulaModule(*m_modules.bvlibTemplate);
+    FormulaSymbols symbols =
+        emitSmtFormula(parser, *formula, *m_modules.bvlibTemplate, options);
+
+    std::vector<unsigned> newAssertions;
+    for (size_t i = 0, e = symbols.sharedAssertions.size(); i != e; ++i)
+      if (m_sharedAssertions.insert(symbols.sharedAssertions[i]).second)
+        newAssertions.push_back(i);
+    if (!newAssertions.empty()) {
+      std::unique_ptr<llvm::Module> shared =
+          CreateFormulaModule(*m_modules.bvlibTemplate);
+      emitSharedAssertions(parser, *shared, *m_modules.bvlibTemplate,
+                           newAssertions, options.liftConstants);
+      llvm::cantFail(m_jit->addIRModule(
+          llvm::orc::ThreadSafeModule(std::move(shared), m_ctx)));
+    }
+
+    llvm::cantFail(m_jit->addIRModule(
+        llvm::orc::ThreadSafeModule(std::move(formula), m_ctx)));
+    return symbols;
+  }
+
+  // Evaluates the formula on the assignments of the table.
+  std::vector<int> evaluate(const FormulaSymbols &symbols,
+                            AssignmentTable &table) {
+    auto batch = reinterpret_cast<void (*)(bv_array ***, size_t, int *)>(
+        llvm::cantFail(m_jit->lookup(symbols.batch)).getAddress());
+    std::vector<int> results(table.size());
+    batch(table.packs(), table.size(), results.data());
+    return results;
+  }
+};
+
+static std::vector<int> jitEvaluate(SmtLibParser &parser,
+                                    AssignmentTable &table,
+                                    const FormulaEmitOptions &options = {}) {
+  FormulaJit jit;
+  return jit.evaluate(jit.addFormula(parser, options), table);
+}
+
+static std::vector<int> interpret(SmtLibParser &parser,
+                                  AssignmentTable &table) {
+  BytecodeProgram program(parser);
+  BytecodeInterpreter interpreter(program);
+  std::vector<int> results(table.size());
+  interpreter.evaluateBatch(table.packs(), table.size(), results.data());
+  return results;
+}
+
+// Evaluates the formula on its assignments with both the JIT and the bytecode
+// interpreter, and checks that they agree.
+static std::vector<int>
+evaluateAndCompare(const std::string &txt,
+                   const FormulaEmitOptions &options = {}) {
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  bv_context *ctx = bv_context_create();
+  std::vector<int> jitResults;
+  {
+    AssignmentTable table(parser, ctx);
+    jitResults = jitEvaluate(parser, table, options);
+    CHECK(jitResults == interpret(parser, table));
+  }
+  bv_context_destroy(ctx);
+  return jitResults;
+}
+
+TEST_CASE("Test smtlib_to_llvm_let_bindings") {
+  std::string txt = R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (let ( (?B1 (select  n (_ bv2 32) ) ) ) (and  (bvult  (_ bv3 8) ?B1 ) (=  false (=  (_ bv7 8) ?B1 ) ) ) ) )
+    (assert (let ( (?B2 (concat  (select  n (_ bv1 32) ) (select  n (_ bv0 32) ) ) ) ) (let ( (?B3 (bvadd  ?B2 (_ bv1 16) ) ) ) (=  (_ bv514 16) ?B3 ) ) ) )
+    ; Assignments
+    ; { "n": [2, 1, 4] }
+    ; { "n": [2, 1, 7] }
+    ; { "n": [2, 1, 2] }
+    ; { "n": [1, 1, 4] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  REQUIRE(parser.numAssertions() == 2);
+
+  bv_context *ctx = bv_context_create();
+  {
+    AssignmentTable table(parser, ctx);
+    const std::vector<int> jitResults = jitEvaluate(parser, table);
+    CHECK(jitResults == std::vector<int>{0, 1, 1, 2});
+
+    BytecodeProgram program(parser);
+    BytecodeInterpreter interpreter(program);
+    std::vector<int> interpResults(table.size());
+    interpreter.evaluateBatch(table.packs(), table.size(),
+                              interpResults.data());
+    CHECK(jitResults == interpResults);
+  }
+  bv_context_destroy(ctx);
+}
+
+TEST_CASE("Test smtlib_to_llvm_dual_entry_points") {
+  std::string txt = R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvult  (_ bv3 8) (select  n (_ bv0 32) ) ) )
+    (assert (=  (_ bv7 8) (select  n (_ bv1 32) ) ) )
+    ; Assignments
+    ; { "n": [4, 7] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  llvm::LLVMContext ctx;
+  FormulaModules modules = prepareFormulaModules(ctx);
+  llvm::Module *formula = modules.formula.get();
+
+  FormulaEmitOptions options;
+  options.dual = true;
+  const FormulaSymbols symbols =
+      emitSmtFormula(parser, *formula, *modules.bvlibTemplate, options);
+
+  // Dual formulas are only evaluated through the dual entry points.
+  CHECK(formula->getFunction(symbols.dual));
+  CHECK(formula->getFunction(symbols.dualBatch));
+  CHECK(symbols.batch.empty());
+  CHECK(symbols.first.empty());
+  CHECK_FALSE(formula->getFunction(symbols.formula));
+}
+
+TEST_CASE("Test smtlib_to_llvm_first_model_entry_point") {
+  std::string txt = R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvult  (_ bv3 8) (select  n (_ bv0 32) ) ) )
+    ; Assignments
+    ; { "n": [4] }
+  )";
+
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+
+  llvm::LLVMContext ctx;
+  FormulaModules modules = prepareFormulaModules(ctx);
+  const llvm::Module &bvlibTemplate = *modules.bvlibTemplate;
+  const FormulaSymbols symbols =
+      emitSmtFormula(parser, *modules.formula, bvlibTemplate);
+  CHECK(modules.formula->getFunction(symbols.batch));
+  CHECK(symbols.first.empty());
+
+  FormulaEmitOptions options;
+  options.first = true;
+  std::unique_ptr<llvm::Module> firstFormula =
+      CreateFormulaModule(bvlibTemplate);
+  const FormulaSymbols firstSymbols =
+      emitSmtFormula(parser, *firstFormula, bvlibTemplate, options);
+  CHECK(firstFormula->getFunction(firstSymbols.batch));
+  CHECK(firstFormula->getFunction(firstSymbols.first));
+}
+
+TEST_CASE("Test smtlib_to_llvm_native_extract") {
+  const std::vector<int> results = evaluateAndCompare(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv5 4) ((_ extract 7  4)  (select  n (_ bv0 32) ) ) ) )
+    (assert (=  (_ bv10 4) ((_ extract 3  0)  (select  n (_ bv0 32) ) ) ) )
+    ; Assignments
+    ; { "n": [90] }
+    ; { "n": [165] }
+    ; { "n": [85] }
+  )");
+  CHECK(results == std::vector<int>{0, 1, 2});
+}
+
+TEST_CASE("Test smtlib_to_llvm_native_extensions") {
+  // Extensions take the resulting width, as in bvlib.
+  const std::vector<int> results = evaluateAndCompare(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv128 16) ((_ zero_extend 16)  (select  n (_ bv0 32) ) ) ) )
+    (assert (=  (_ bv65408 16) ((_ sign_extend 16)  (select  n (_ bv1 32) ) ) ) )
+    (assert (bvslt  ((_ sign_extend 64)  (select  n (_ bv2 32) ) ) (_ bv0 64) ) )
+    ; Assignments
+    ; { "n": [128, 128, 200] }
+    ; { "n": [128, 128, 100] }
+    ; { "n": [128, 255, 200] }
+    ; { "n": [127, 128, 200] }
+  )");
+  CHECK(results == std::vector<int>{0, 3, 2, 1});
+}
+
+TEST_CASE("Test smtlib_to_llvm_native_arithmetic") {
+  const std::vector<int> results = evaluateAndCompare(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvslt  (select  n (_ bv0 32) ) (_ bv1 8) ) )
+    (assert (=  (_ bv4 8) (bvmul  (select  n (_ bv1 32) ) (select  n (_ bv2 32) ) ) ) )
+    ; Assignments
+    ; { "n": [255, 2, 130] }
+    ; { "n": [128, 2, 3] }
+    ; { "n": [2, 2, 2] }
+    ; { "n": [0, 4, 1] }
+  )");
+  CHECK(results == std::vector<int>{0, 2, 1, 0});
+}
+
+TEST_CASE("Test smtlib_to_llvm_packed_select_out_of_range") {
+  // Reads past the end of an array give the zero element stored after it, as
+  // in bvlib.
+  const std::vector<int> results = evaluateAndCompare(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv0 8) (select  n (_ bv4294967295 32) ) ) )
+    (assert (=  (select  n (_ bv2 32) ) (select  n (_ bv7 32) ) ) )
+    ; Assignments
+    ; { "n": [1, 2] }
+    ; { "n": [1, 2, 3] }
+  )");
+  CHECK(results == std::vector<int>{0, 2});
+}
+
+TEST_CASE("Test smtlib_to_llvm_wide_bitvectors") {
+  // Bitvectors over 64 bits are not lowered natively, and call bvlib.
+  const std::vector<int> results = evaluateAndCompare(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (=  (_ bv300 96) (bvadd  ((_ zero_extend 96)  (select  n (_ bv0 32) ) ) ((_ zero_extend 96)  (select  n (_ bv1 32) ) ) ) ) )
+    (assert (bvult  ((_ sign_extend 96)  (select  n (_ bv1 32) ) ) (_ bv100 96) ) )
+    (assert (=  (_ bv250 8) ((_ extract 7  0)  ((_ zero_extend 96)  (select  n (_ bv0 32) ) ) ) ) )
+    ; Assignments
+    ; { "n": [200, 100] }
+    ; { "n": [250, 60] }
+    ; { "n": [210, 90] }
+    ; { "n": [250, 50] }
+  )");
+  CHECK(results == std::vector<int>{2, 1, 3, 0});
+}
+
+TEST_CASE("Test smtlib_to_llvm_shared_assertions") {
+  std::string txt = R"(
+    (declare-fun a () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (declare-fun b () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (bvult  (_ bv3 8) (select  a (_ bv0 32) ) ) )
+    (assert (=  (_ bv7 8) (bvadd  (select  a (_ bv1 32) ) (select  b (_ bv0 32) ) ) ) )
+    (assert (bvult  (_ bv3 8) (select  b (_ bv0 32) ) ) )
+    ; Assignments
+    ; { "a": [4, 3], "b": [4] }
+    ; { "a": [2, 3], "b": [4] }
+    ; { "a": [4, 4], "b": [4] }
+    ; { "a": [5, 5], "b": [2] }
+  )";
+
+  FormulaEmitOptions options;
+  options.shareAssertions = true;
+
+  // The first and the last assertions only differ in the array they read, so
+  // they call the same shared function.
+  std::istringstream iss(txt);
+  SmtLibParser parser(iss);
+  llvm::LLVMContext ctx;
+  FormulaModules modules = prepareFormulaModules(ctx);
+  const FormulaSymbols symbols =
+      emitSmtFormula(parser, *modules.formula, *modules.bvlibTemplate, options);
+  REQUIRE(symbols.sharedAssertions.size() == 3);
+  CHECK(symbols.sharedAssertions[0] == symbols.sharedAssertions[2]);
+  CHECK(symbols.sharedAssertions[0] != symbols.sharedAssertions[1]);
+
+  CHECK(evaluateAndCompare(txt, options) == std::vector<int>{0, 1, 2, 3});
+}
+
+TEST_CASE("Test smtlib_to_llvm_lifted_constants") {
+  // The queries only differ in their literals.
+  std::istringstream issA(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (and  (bvult  (_ bv3 8) (select  n (_ bv0 32) ) ) (=  (_ bv7 8) (select  n (_ bv1 32) ) ) ) )
+    ; Assignments
+    ; { "n": [4, 7] }
+    ; { "n": [9, 7] }
+    ; { "n": [2, 7] }
+    ; { "n": [9, 6] }
+  )");
+  std::istringstream issB(R"(
+    (declare-fun n () (Array (_ BitVec 32) (_ BitVec 8) ) )
+    (assert (and  (bvult  (_ bv5 8) (select  n (_ bv1 32) ) ) (=  (_ bv9 8) (select  n (_ bv0 32) ) ) ) )
+    ; Assignments
+    ; { "n": [4, 7] }
+    ; { "n": [9, 7] }
+    ; { "n": [2, 7] }
+    ; { "n": [9, 6] }
+  )");
+  SmtLibParser parserA(issA);
+  SmtLibParser parserB(issB);
+
+  FormulaEmitOptions options;
+  options.shareAssertions = true;
+  options.liftConstants = true;
+
+  // The shape function is only emitted for the first query, and the second
+  // one passes its own literals to it.
+  FormulaJit jit;
+  const FormulaSymbols symbolsA = jit.addFormula(parserA, options);
+  const FormulaSymbols symbolsB = jit.addFormula(parserB, options);
+  REQUIRE(symbolsA.sharedAssertions.size() == 1);
+  REQUIRE(symbolsB.sharedAssertions.size() == 1);
+  CHECK(llvm::StringRef(symbolsA.sharedAssertions[0]).startswith("smt_shape_"));
+  CHECK(symbolsA.sharedAssertions[0] == symbolsB.sharedAssertions[0]);
+
+  bv_context *ctx = bv_context_create();
+  {
+    AssignmentTable tableA(parserA, ctx);
+    const std::vector<int> resultsA = jit.evaluate(symbolsA, tableA);
+    CHECK(resultsA == std::vector<int>{0, 0, 1, 1});
+    CHECK(resultsA == interpret(parserA, tableA));
+
+    AssignmentTable tableB(parserB, ctx);
+    const std::vector<int> resultsB = jit.evaluate(symbolsB, tableB);
+    CHECK(resultsB == std::vector<int>{1, 0, 1, 0});
+    CHECK(resultsB == interpret(parserB, tableB));
+  }
+  bv_context_destroy(ctx);
+}